@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Application supplied output buffers for the manual decoder flow(decoder option flow=manual), e.g. mapped upload buffers or a shared memory ring.
+  Processed images are written into alloc() results and wrapped as VideoFrame planes without copy.
+  Set decoder option allocator to the address of this struct, e.g. "BRAW:flow=manual:allocator=0x7ffd1234".
+  The struct must be alive until the reader is unloaded and all frames are released.
+ */
+struct BRawAllocator {
+    void* opaque;
+/*
+  return a cpu buffer of at least size bytes, planes are contiguous. format is mdk PixelFormat.
+  return NULL to use internal buffers for this frame. called in braw threads
+ */
+    uint8_t* (*alloc)(void* opaque, size_t size, int width, int height, int format);
+/*
+  data is no longer used by the reader and frames
+ */
+    void (*release)(void* opaque, uint8_t* data);
+};
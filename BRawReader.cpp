@@ -12,18 +12,37 @@
 #include "mdk/VideoFrame.h"
 #include "mdk/AudioFrame.h"
 #include "BlackmagicRawAPI.h"
+#include "BRawAllocator.h"
+#include "BRawResourceManager.h"
 #include "BRawVideoBufferPool.h"
+#include "BufferPool.h"
+#include "FrameCache.h"
+#include "JobTable.h"
+#include "MpscQueue.h"
+#include "StagingRing.h"
 #include "ComPtr.h"
 #include "BStr.h"
+#include "Convert.h"
+#include "Pcm.h"
 #include "Variant.h"
+#include "Waveform.h"
 #include "base/Hash.h"
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <iostream>
+#include <map>
+#include <optional>
 #include <string_view>
 #include <mutex>
 #include <thread>
+#include <utility>
 
 using namespace std;
 using namespace Microsoft::WRL; //ComPtr
@@ -44,7 +63,12 @@ class BRawReader final : public FrameReader, public IBlackmagicRawCallback
 {
 public:
     BRawReader();
-    ~BRawReader() override = default;
+    ~BRawReader() override {
+        stopRefine();
+        stopAudio();
+        stopWaveform();
+        stopDelivery();
+    }
     const char* name() const override { return "BRAW"; }
     void setTimeout(int64_t value, TimeoutCallback cb) override {}
     bool load() override;
@@ -55,7 +79,7 @@ public:
     // IBlackmagicRawCallback
     void ReadComplete(IBlackmagicRawJob* readJob, HRESULT result, IBlackmagicRawFrame* frame) override;
     void ProcessComplete(IBlackmagicRawJob* procJob, HRESULT result, IBlackmagicRawProcessedImage* processedImage) override;
-    void DecodeComplete(IBlackmagicRawJob*, HRESULT) override {}
+    void DecodeComplete(IBlackmagicRawJob* decodeJob, HRESULT result) override;
     void TrimProgress(IBlackmagicRawJob*, float info) override {}
     void TrimComplete(IBlackmagicRawJob*, HRESULT) override {}
     void SidecarMetadataParseWarning(IBlackmagicRawClip*, BRawStr fileName, uint32_t lineNumber, BRawStr info) override {}
@@ -72,46 +96,288 @@ protected:
     void onPropertyChanged(const std::string& /*key*/, const std::string& /*value*/) override;
 private:
     bool setupPipeline();
-    bool readAt(uint64_t index);
+    bool loadClip(); // load() in Loading phase
+    bool running() const { return phase_.load(memory_order_acquire) == Phase::Running; } // loaded, maybe seeking
+    bool readAt(uint64_t index, uint32_t epoch, BlackmagicRawResolutionScale scale = 0, bool refine = false);
+    struct UserData;
+    HRESULT createReadJob(UserData* data, IBlackmagicRawJob** job);
+    bool prepareManual(IBlackmagicRawFrame* frame, UserData* data); // frame state and buffers. false if buffers are not available
+    bool submitDecode(IBlackmagicRawFrame* frame, UserData* data); // manual flow. false if buffers are not available
+    HRESULT submitProcess(UserData* data);
+    void retain(UserData* data); // keep decoded buffer for regrade
+    void regrade(); // process the current frame again with new attributes
+    bool setAttribute(const string& key, const string& val); // true if a processing attribute is changed
+    void updateClipAttributes();
+    void processingAttributes(IBlackmagicRawFrame* frame, ComPtr<IBlackmagicRawClipProcessingAttributes>& clipAttrs, ComPtr<IBlackmagicRawFrameProcessingAttributes>& frameAttrs);
+    void releaseManual(UserData* data);
+    void processed(UserData* data, HRESULT result, IBlackmagicRawProcessedImage* processedImage); // takes data. delivery thread only
+    void enqueue(UserData* data, HRESULT result, IBlackmagicRawProcessedImage* processedImage); // called by sdk threads, processed() in delivery thread
+    void deliveryLoop();
+    void requestDelivery(); // wake up the delivery thread
+    void stopDelivery(); // returns immediately if called by the delivery thread
+    bool startAudio(AudioStreamInfo& info); // info.codec.format is updated to the output format
+    struct AudioOutput {
+        bool toFloat = false; // convert to float
+        bool planar = false; // convert to planar float
+        uint32_t chunk = 1024; // samples per channel of an AudioFrame
+        uint32_t ahead = 4; // chunks read before delivery
+    };
+    void audioLoop(AudioOutput out); // options are copied, never changed by onPropertyChanged() while running
+    void seekAudio(uint64_t index); // to the 1st sample of video frame index
+    void stopAudio();
+    void startWaveform();
+    void waveformLoop(string url);
+    void stopWaveform();
+    struct SeekRequest {
+        uint64_t index = 0;
+        int id = 0;
+        bool waitFrame = true;
+        bool preview = false; // decode at scrubScale_
+        bool step = false; // frame step
+        int direction = 1;
+    };
+    bool submitSeek(const SeekRequest& req);
+    void track(IBlackmagicRawJob* job, uint32_t epoch);
+    void untrack(IBlackmagicRawJob* job);
+    void abortStale(); // abort jobs not in current epoch
+    bool stale(uint32_t epoch) const;
+    void scheduleRefine(uint64_t index, uint32_t epoch);
+    void refineLoop();
+    void stopRefine();
     void parseDecoderOptions();
     void setDecoderOption(const char* key, const char* val);
 
+    VideoFrame toFrame(IBlackmagicRawProcessedImage* processedImage);
+    int stage(IBlackmagicRawProcessedImage* processedImage); // queue the staging copy of an opencl image. slot or -1
+    StagingRing* staging(void* context, void* cmdQueue); // delivery thread only
+    VideoFrame toFrame(UserData& data); // manual flow. takes external processed buffer
+    bool reshape(uint32_t width, uint32_t height) const; // cpu images are resized or converted by reader
+    VideoFrame toFormat(const uint8_t* data, size_t stride, uint32_t width, uint32_t height); // in format_ and exact size
+    void scaledSize(BlackmagicRawResolutionScale scale, uint32_t* width, uint32_t* height) const;
+    // pending: job of index is created by caller. step: prefetch frames in direction even if paused. return the new epoch
+    uint32_t resetSchedule(uint64_t index, bool pending = false, int direction = 1, bool step = false);
+    int stride(float rate) const; // frames advanced per shown frame
+    int64_t advance(int64_t index) const; // next shown index after index. sched_mtx_
+    bool schedule(); // keep up to depth_ frames in flight
+    uint64_t prefetchFrames() const;
+    struct Decoded;
+    void complete(uint64_t index, uint32_t epoch, Decoded&& d);
+    void deliver(); // deliver reordered frames in index order. delivery thread only
+    bool deliverFrame(uint64_t index, const VideoFrame& frame, bool seek, int direction);
+    void updateProgress();
+    void updateCacheStats(); // delivery thread only
+    void updateMemoryStats(); // delivery thread only
+    void updateReadStats(IBlackmagicRawFrame* frame); // counters only, any thread
+    void publishStats(); // setProperty() of counters changed by other threads. delivery thread only
+    bool late(uint64_t index, int64_t pts); // can not be presented in time, drop before decoding
+    void adapt(double ms, BlackmagicRawResolutionScale scale); // decode + process time of a playback frame decoded at scale
+
+    struct Joint;
     struct UserData {
         uint64_t index = 0;
+        int64_t pts = 0; // ms
+        uint32_t epoch = 0;
         int seekId = 0;
         bool seekWaitFrame = true;
+        uint8_t* bitStream = nullptr; // from bitStreams_, in use until ProcessComplete
+        BlackmagicRawResolutionScale scale = 0; // 0: scale_
+        bool refine = false; // full resolution decode of a scrub preview
+        // manual flow buffers. bitStream is released in DecodeComplete, others in ProcessComplete
+        uint8_t* frameState = nullptr;
+        uint8_t* decoded = nullptr;
+        uint8_t* processed = nullptr;
+        uint8_t* post3DLUT = nullptr;
+        uint32_t processedBytes = 0;
+        bool external = false; // processed is from allocator_
+        bool decodedReady = false;
+        ComPtr<IBlackmagicRawFrame> frame; // to populate frame state again for regrade
+        bool regrade = false; // processing attributes changed, replaces the displayed frame
+        chrono::steady_clock::time_point decodeStart; // ReadComplete
+        uint32_t track = 0; // video track of clip
+        uint32_t part = 0; // index of track in tracks_
+        shared_ptr<Joint> joint; // multiple tracks
         unordered_map<string,string> metadata;
         unordered_map<string,string> attributes;
     };
 
+    struct Decoded {
+        VideoFrame frame; // invalid if failed to read/decode, skipped when delivering
+        bool seek = false;
+        uint32_t bytes = 0; // processed image size
+        bool refine = false; // replaces the last delivered preview frame
+        bool regrade = false; // replaces the displayed frame, not a seek job
+        vector<VideoFrame> tracks; // other selected tracks of the same index, packed with frame when delivering
+    };
+
+    struct Joint { // results of selected tracks of an index, completed together
+        mutex mtx;
+        vector<Decoded> parts;
+        int pending = 1; // jobs in flight + submitter
+    };
+    bool submitRead(UserData* data); // takes data. read jobs of selected tracks. false if nothing is submitted
+    void completePart(const shared_ptr<Joint>& joint, int part, uint64_t index, uint32_t epoch, Decoded&& d); // part < 0: submitter
+
     ComPtr<IBlackmagicRawFactory> factory_;
     ComPtr<IBlackmagicRaw> codec_;
     ComPtr<IBlackmagicRawPipelineDevice> dev_;
     ComPtr<IBlackmagicRawResourceManager> resMgr_;
+    ComPtr<BRawResourceManager> resPool_; // resMgr_ if enabled. alive until the next load() because native buffers may use resMgr_
+    bool resourcePool_ = true;
+    bool hugePages_ = false;
+    array<atomic<uint64_t>, 5> memStats_{}; // published live bytes per usage and cached bytes
     ComPtr<IBlackmagicRawClip> clip_;
-    void* processedRes_ = nullptr; // cpu readable(gpu writable?) in copy mode
-    uint8_t* processedResCpu_ = nullptr; // cpu buffer for OpenCL copy
-    BlackmagicRawResourceType processedType_ = 0;
+    ComPtr<IBlackmagicRawClipEx> clipEx_; // read into pooled bitstream buffers
+    ComPtr<IBlackmagicRawClipMultiVideo> multi_;
+    vector<uint32_t> tracksOpt_ = {0}; // video tracks option
+    vector<uint32_t> tracks_ = {0}; // selected existing tracks, decoded concurrently
+    bool tracksVertical_ = false; // pack tracks top to bottom, otherwise side by side
+    shared_ptr<BufferPool> packBufs_; // packed frames of all tracks_, shared with frames
+    ComPtr<IBlackmagicRawClipImmersiveVideo> immersive_; // tracks_ are left and right eyes
+    optional<bool> stereo_; // immersive clip: decode both eyes and pack vertically or not
+    BufferPool bitStreams_;
+    ComPtr<IBlackmagicRawManualDecoderFlow1> flow1_; // cpu only. decode and process are separated jobs
+    BufferPool frameStates_;
+    BufferPool decodedBufs_;
+    BufferPool processedBufs_;
+    BufferPool lutBufs_;
+    bool manual_ = false; // requested by user
+    const BRawAllocator* allocator_ = nullptr; // processed buffers of manual flow, owned by user
+    struct Retained {
+        ComPtr<IBlackmagicRawFrame> frame;
+        uint8_t* decoded = nullptr; // from decodedBufs_
+        BlackmagicRawResolutionScale scale = 0;
+    };
+    uint32_t regrade_ = 3; // decoded frames kept around the current index in manual flow
+    map<uint64_t, Retained> retained_; // guarded by sched_mtx_
+    bool regrading_ = false; // guarded by sched_mtx_
+    bool regradePending_ = false; // attributes changed again while regrading
+
+    mutex attr_mtx_;
+    unordered_map<uint32_t, string> clipOverrides_; // user set processing attributes, key is FOURCC
+    unordered_map<uint32_t, string> frameOverrides_;
+    ComPtr<IBlackmagicRawClipProcessingAttributes> clipAttrs_; // with clipOverrides_ applied, replaced if changed. null if no override
+    bool publishing_ = false; // setProperty() of clip attributes in load()
+    FrameCache cache_;
+    atomic<uint64_t> cacheHits_ = 0; // published values
+    atomic<uint64_t> cacheMisses_ = 0;
+    atomic<uint64_t> readBytes_ = 0; // bitstream bytes read since load()
+    atomic<uint32_t> lastReadBytes_ = 0;
+    uint64_t readPublished_ = 0; // published values, delivery thread only
+    uint64_t droppedPublished_ = 0;
+    shared_ptr<StagingRing> staging_; // cpu readable copies of gpu images in copy mode, shared with frames
+    uint32_t stagingSlots_ = 0; // 0: frames of the delivery window, staged results and renderer. frames cached are copied out of slots
+    int staged_ = -1; // slot of the result being processed, queued by stage() with the whole batch
     BlackmagicRawPipeline pipeline_ = blackmagicRawPipelineCPU; // set by user only
     BlackmagicRawInterop interop_ = blackmagicRawInteropNone;
     string deviceName_; // opencl device can be NVIDIA(adapter name? nv does not work and slow?), gfx90c(amd?). cpu device can be AVX2, AVX, SSE 4.1
     PixelFormat format_ = PixelFormat::RGBA;
+    shared_ptr<BufferPool> convertBufs_; // outputs of formats converted from rgba64le, shared with frames
+    convert::Matrix yuvMatrix_ = convert::Matrix::BT709;
+    bool yuvFullRange_ = false;
+    int convertThreads_ = 0; // 0: up to 8
+    unique_ptr<convert::Pool> convertPool_; // created by loadClip(), a frame converted while another one is in progress uses its own thread only
     int copy_ = 0; // copy gpu resources. only works for cuda pipeline, otherwise still copies.
     BlackmagicRawResolutionScale scale_ = blackmagicRawResolutionScaleFull; // higher fps if scaled
     uint32_t scaleToW_ = 0; // closest down scale to target width
     uint32_t scaleToH_ = 0;
+    bool adaptive_ = false;
+    atomic<BlackmagicRawResolutionScale> adaptiveScale_ = 0; // lower than scale_ if decoding is slower than real time. 0: scale_
+    double adaptCost_ = 0; // ms, moving average of decode + process time per frame. delivery thread only
+    int adaptSamples_ = 0; // since the last scale change
+    optional<convert::Filter> resize_; // resize to exact scaleToW_ x scaleToH_ from the closest larger scale
+    uint32_t outW_ = 0; // exact output size, 0: decoded size
+    uint32_t outH_ = 0;
     uint32_t threads_ = 0;
+    BlackmagicRawResolutionScale scrubScale_ = 0; // low resolution preview of seeks. 0: disabled
+    int64_t scrubDelay_ = 150; // ms. refine the preview at scale_ if seek position is stable for this duration
+    uint32_t depth_ = 1; // max read/decode jobs in flight. 1: low latency, >1: throughput
+    int64_t prefetch_ = 0; // target duration(ms) of decoded frames queued ahead of the play position
     int64_t duration_ = 0;
     int64_t frames_ = 0;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
     atomic<int> seeking_ = 0;
     atomic<uint64_t> index_ = 0; // for stepping frame forward/backward
+    atomic<int> rate_direction_ = 1; // sign of playback rate
+    atomic<float> rate_ = 1; // abs playback rate
+    float displayFps_ = 0; // display refresh rate. 0: clip frame rate
+    float fastRate_ = 0; // decode at 1/4 scale if rate_ >= fastRate_. 0: disabled
+    int64_t deadline_ = -1; // ms a frame can be late before dropped in ReadComplete. < 0: never drop
+    atomic<uint64_t> dropped_ = 0; // late frames since load()
+
+    mutable mutex sched_mtx_;
+    atomic<uint32_t> epoch_ = 0; // increased by seek and unload under sched_mtx_, results of jobs from an old epoch are dropped without locks
+    int64_t next_ = 0; // next index to read
+    int64_t expect_ = 0; // next index to deliver
+    int direction_ = 1; // -1: reverse playback or stepping backward, frames are read and delivered in descending order
+    bool stepping_ = false; // prefetch in direction_ for the next frame step
+    int stride_ = 1; // > 1: fast playback, frames can not be shown are not read
+    uint32_t inflight_ = 0; // read/decode jobs in current epoch
+    bool halted_ = true; // stop scheduling until the next seek, e.g. frame rejected or end of stream
+    map<uint64_t, Decoded> reorder_; // out of order ProcessComplete results, and prefetched frames waiting for delivery
+    JobTable<IBlackmagicRawJob> jobs_; // lock free, stale callbacks never wait for the scheduler
+    bool seekInFlight_ = false; // only 1 seek job is running
+    optional<SeekRequest> pendingSeek_; // latest seek waiting for the running seek job, older ones are completed immediately
+    chrono::steady_clock::time_point anchorTime_; // presentation clock: pts anchorPts_ was accepted by frameAvailable() at anchorTime_
+    int64_t anchorPts_ = -1; // -1: not started in current epoch
+    int drops_ = 0; // consecutive late frames
+    atomic<bool> presenting_ = false; // blocked in frameAvailable(), i.e. paused or ahead of the renderer, never late
+
+    struct Processed {
+        UserData* data = nullptr;
+        HRESULT result = S_OK;
+        ComPtr<IBlackmagicRawProcessedImage> image;
+        int staged = -1; // staging slot
+    };
+    MpscQueue<Processed> results_; // pushed by sdk callback threads, never blocks them
+    vector<Processed> batch_; // results popped at once, copies of opencl images are queued together. delivery thread only
+    atomic<uint32_t> wake_ = 0; // increased by new results and delivery requests
+    atomic<bool> deliveryStop_ = false;
+    thread deliverer_; // results are processed and frames are delivered in this thread, sdk threads never wait for frameAvailable()
+
+    ComPtr<IBlackmagicRawClipAudio> audio_;
+    bool audioEnabled_ = true;
+    AudioOutput audioOpt_;
+    int audioBits_ = 0;
+    int audioChannels_ = 0;
+    int audioRate_ = 0;
+    int64_t audioSamples_ = 0;
+    AudioFormat::SampleFormat audioFormat_ = AudioFormat::SampleFormat::Unknown; // output
+    shared_ptr<BufferPool> audioBufs_; // samples read ahead, shared with frames
+    atomic<int64_t> audioSeek_ = -1; // sample to read from. -1: continue
+    atomic<uint32_t> audioWake_ = 0;
+    atomic<bool> audioStop_ = false;
+    thread audioer_; // audio is read and delivered in this thread, never blocks video delivery
+
+    bool waveform_ = false;
+    string waveformDir_; // empty: temp dir
+    mutex waveformMtx_;
+    string waveformFile_; // guarded by waveformMtx_
+    atomic<bool> waveformReady_ = false; // waveformFile_ is not published
+    atomic<bool> waveformStop_ = false;
+    thread waveformer_;
+
+    mutex refine_mtx_;
+    condition_variable refine_cv_;
+    thread refiner_;
+    bool refineStop_ = false;
+    optional<pair<uint64_t, uint32_t>> refine_; // index and epoch of the last preview
+    chrono::steady_clock::time_point refineAt_;
+    atomic<int> progress_ = -1; // last buffering progress
 
     void* context_ = nullptr;
     void* cmdQueue_ = nullptr;
     NativeVideoBufferPoolRef pool_;
-    mutex unload_mtx_;
-    shared_ptr<bool> loaded_;
-    shared_ptr<mutex> res_mtx_;
+    // Idle -> Loading -> Running -> Draining -> Unloaded -> Loading ...
+    // Seeking is Running with seeking_ > 0. Draining: unload() in progress, no frame is delivered
+    enum class Phase : uint8_t { Idle, Loading, Running, Draining, Unloaded };
+    atomic<Phase> phase_ = Phase::Idle;
+    struct Sdk { // objects required to release processed images
+        ComPtr<IBlackmagicRaw> codec;
+        ComPtr<IBlackmagicRawPipelineDevice> dev;
+        ComPtr<IBlackmagicRawResourceManager> resMgr;
+    };
+    shared_ptr<const Sdk> sdk_; // referenced by frames, sdk objects are destroyed after unload() and all frames are destroyed
 };
 
 template<typename Callback> // function<void(const string&,const string&)>
@@ -274,17 +540,28 @@ static void to(MediaInfo& info, const ComPtr<IBlackmagicRawClip>& clip)
     MS_WARN(clip->GetFrameCount((uint64_t*)&vsi.frames));
     vsi.duration = vsi.frames * (1000.0 / vcp.frame_rate);
     vsi.codec = vcp;
-    info.video.reserve(1);
     info.video.push_back(vsi);
     info.duration = vsi.duration;
 
+    ComPtr<IBlackmagicRawClipMultiVideo> multi;
+    uint32_t tracks = 1;
+    if (SUCCEEDED(clip->QueryInterface(IID_IBlackmagicRawClipMultiVideo, &multi)))
+        MS_WARN(multi->GetVideoTrackCount(&tracks));
+    for (uint32_t i = 1; i < tracks; ++i) { // every track is a stream, same codec parameters
+        vsi.index = (int)i;
+        MS_WARN(multi->GetVideoFrameCount(i, (uint64_t*)&vsi.frames));
+        vsi.duration = vsi.frames * (1000.0 / vcp.frame_rate);
+        info.video.push_back(vsi);
+        info.streams++;
+    }
+
     ComPtr<IBlackmagicRawClipAudio> audio;
     if (FAILED(clip->QueryInterface(IID_IBlackmagicRawClipAudio, &audio)))
         return;
     info.streams++;
     AudioCodecParameters acp;
     AudioStreamInfo asi;
-    asi.index = 1;
+    asi.index = (int)info.video.size();
     acp.codec = "pcm";
     MS_WARN(audio->GetAudioChannelCount((uint32_t*)&acp.channels));
     MS_WARN(audio->GetAudioSampleRate((uint32_t*)&acp.sample_rate));
@@ -335,6 +612,30 @@ static PixelFormat to(BlackmagicRawResourceFormat fmt)
     }
 }
 
+// formats not supported by sdk, converted from blackmagicRawResourceFormatRGBAU16
+static bool to(PixelFormat fmt, convert::Target* target)
+{
+    switch (fmt) {
+    case PixelFormat::NV12: *target = convert::Target::NV12; return true;
+    case PixelFormat::P010LE: *target = convert::Target::P010; return true;
+    case PixelFormat::YUV422P10LE: *target = convert::Target::YUV422P10; return true;
+    case PixelFormat::X2RGB10LE: *target = convert::Target::X2RGB10; return true;
+    default: return false;
+    }
+}
+
+// bytes per channel of 4 channel formats can be resized
+static int channelBytes(PixelFormat fmt)
+{
+    switch (fmt) {
+    case PixelFormat::RGBA:
+    case PixelFormat::BGRA: return 1;
+    case PixelFormat::RGBA64LE:
+    case PixelFormat::BGRA64LE: return 2;
+    default: return 0;
+    }
+}
+
 static BlackmagicRawResourceFormat from(PixelFormat fmt)
 {
     switch (fmt) {
@@ -350,6 +651,10 @@ static BlackmagicRawResourceFormat from(PixelFormat fmt)
     case PixelFormat::RGBAF32LE: return blackmagicRawResourceFormatRGBAF32;
     case PixelFormat::RGBF16LE: return blackmagicRawResourceFormatRGBF16;
     case PixelFormat::RGBAF16LE: return blackmagicRawResourceFormatRGBAF16;
+    case PixelFormat::NV12: // converted by reader
+    case PixelFormat::P010LE:
+    case PixelFormat::YUV422P10LE:
+    case PixelFormat::X2RGB10LE: return blackmagicRawResourceFormatRGBAU16;
     default:
         return blackmagicRawResourceFormatRGBAU8;
     }
@@ -368,10 +673,20 @@ BRawReader::BRawReader()
 }
 
 bool BRawReader::load()
+{
+    auto from = phase_.load();
+    if ((from != Phase::Idle && from != Phase::Unloaded) || !phase_.compare_exchange_strong(from, Phase::Loading))
+        return false; // loading, loaded or unloading in another thread
+    if (loadClip())
+        return true;
+    unload(); // stop threads started by loadClip() and release sdk objects, from Loading or Running. phase_ is Unloaded
+    return false;
+}
+
+bool BRawReader::loadClip()
 {
     if (!factory_)
         return false;
-    res_mtx_ = make_shared<mutex>();
     MS_ENSURE(factory_->CreateCodec(&codec_), false);
     MS_ENSURE(codec_->SetCallback(this), false);
     ComPtr<IBlackmagicRawConfiguration> config;
@@ -397,89 +712,241 @@ bool BRawReader::load()
     ComPtr<IBlackmagicRawConfigurationEx> configEx;
     MS_ENSURE(codec_->QueryInterface(IID_IBlackmagicRawConfigurationEx, (void**)&configEx), false);
     MS_ENSURE(configEx->GetResourceManager(&resMgr_), false);
+    resPool_.Reset();
+    if (resourcePool_) {
+        resPool_.Attach(new BRawResourceManager(resMgr_.Get())); // gpu resources are created by the default manager
+        resPool_->setHugePages(hugePages_);
+        if (SUCCEEDED(configEx->SetResourceManager(resPool_.Get())))
+            resMgr_ = resPool_.Get();
+        else
+            resPool_.Reset();
+    }
     BlackmagicRawInstructionSet instruction;
     MS_ENSURE(configEx->GetInstructionSet(&instruction), false);
     clog << "BlackmagicRawInstructionSet: " << FOURCC_name(instruction) << endl;
 
     BStr file(url().data());
     MS_ENSURE(codec_->OpenClip(file.get(), &clip_), false);
+    uint32_t trackCount = 1;
+    if (SUCCEEDED(clip_->QueryInterface(IID_IBlackmagicRawClipMultiVideo, &multi_)))
+        MS_WARN(multi_->GetVideoTrackCount(&trackCount));
+    tracks_.clear();
+    for (auto t : tracksOpt_) {
+        if (t < trackCount && find(tracks_.begin(), tracks_.end(), t) == tracks_.end())
+            tracks_.push_back(t);
+    }
+    if (tracks_.empty())
+        tracks_.push_back(0);
+    if (stereo_ && SUCCEEDED(clip_->QueryInterface(IID_IBlackmagicRawClipImmersiveVideo, &immersive_))) {
+        tracks_ = {blackmagicRawImmersiveVideoTrackLeft, blackmagicRawImmersiveVideoTrackRight};
+        clog << "immersive stereo, " << (*stereo_ ? "top-bottom" : "side by side") << endl;
+    }
+    packBufs_.reset(); // the old pool is alive until all frames are destroyed
+    if (tracks_.size() > 1) {
+        packBufs_ = make_shared<BufferPool>();
+        packBufs_->reset(0, depth_ + 4); // a block is tracks_.size() frames
+    }
+    if (SUCCEEDED(clip_->QueryInterface(IID_IBlackmagicRawClipEx, &clipEx_))) {
+        uint32_t maxBytes = 0;
+        MS_WARN(clipEx_->GetMaxBitStreamSizeBytes(&maxBytes));
+        bitStreams_.reset(maxBytes, (depth_ + 2) * tracks_.size()); // + seek jobs. if exhausted, the sdk allocates
+        clog << "max bitstream size: " << maxBytes << endl;
+    }
+    if (manual_ && pipeline_ == blackmagicRawPipelineCPU && clipEx_ && SUCCEEDED(codec_->QueryInterface(IID_IBlackmagicRawManualDecoderFlow1, &flow1_))) {
+        uint32_t stateBytes = 0;
+        MS_ENSURE(flow1_->GetFrameStateSizeBytes(&stateBytes), false);
+        const auto n = depth_ + 2; // same as bitstreams
+        frameStates_.reset(stateBytes, n);
+        decodedBufs_.reset(0, n + regrade_); // sizes depend on scale and format
+        processedBufs_.reset(0, n);
+        lutBufs_.reset(0, n);
+        clog << "manual decoder flow. frame state size: " << stateBytes << endl;
+    }
 
-    loaded_ = make_shared<bool>();
+    readBytes_ = 0;
+    dropped_ = 0;
+    readPublished_ = 0;
+    droppedPublished_ = 0;
+    adaptiveScale_ = 0;
+    adaptCost_ = 0;
+    adaptSamples_ = 0;
+    sdk_ = make_shared<const Sdk>(Sdk{codec_, dev_, resMgr_});
+    if (deliverer_.joinable()) // stopped by itself at the end of the last clip
+        deliverer_.join();
+    deliveryStop_ = false;
+    deliverer_ = thread(&BRawReader::deliveryLoop, this);
 
     MediaEvent e{};
     e.category = "decoder.video";
     e.detail = "braw";
     dispatchEvent(e);
 
+    outW_ = outH_ = 0;
     if (scaleToW_ > 0 || scaleToH_ > 0) {
         ComPtr<IBlackmagicRawClipResolutions> res;
         MS_ENSURE(clip_->QueryInterface(IID_IBlackmagicRawClipResolutions, &res), false);
-        uint32_t retW = 0, retH = 0;
-        res->GetClosestScaleForResolution(scaleToW_, scaleToH_
-#if (BRAW_MAJOR + 0) < 3
-            , false
-#endif
-            , &scale_);
-        clog << "desired resolution: " << scaleToW_ << "x" << scaleToH_ << ", result: " << retW << "x" << retH << " scale: " << FOURCC_name(scale_) << endl;
+        uint32_t clipW = 0, clipH = 0;
+        MS_ENSURE(clip_->GetWidth(&clipW), false);
+        MS_ENSURE(clip_->GetHeight(&clipH), false);
+        // a single dimension keeps the aspect ratio
+        uint32_t retW = scaleToW_ ? scaleToW_ : std::max(uint32_t(uint64_t(scaleToH_) * clipW / clipH), 1u);
+        uint32_t retH = scaleToH_ ? scaleToH_ : std::max(uint32_t(uint64_t(scaleToW_) * clipH / clipW), 1u);
+        convert::Target target;
+        if (resize_ && !to(format_, &target) && !channelBytes(format_)) {
+            clog << "can not resize " << VideoFormat(format_) << ", use the closest scale" << endl;
+        } else if (resize_) {
+            outW_ = retW;
+            outH_ = retH;
+            retW = clipW;
+            retH = clipH;
+        }
         uint32_t count = 0;
         MS_WARN(res->GetResolutionCount(&count));
         for (uint32_t i = 0; i < count; ++i) {
             uint32_t w = 0, h = 0;
             MS_ENSURE(res->GetResolution(i, &w, &h), false);
             clog << "supported resolution " << w << "x" << h << endl;
+            if (outW_ && w >= outW_ && h >= outH_ && w * h < retW * retH) { // the smallest not less than output
+                retW = w;
+                retH = h;
+            }
         }
+        res->GetClosestScaleForResolution(retW, retH
+#if (BRAW_MAJOR + 0) < 3
+            , false
+#endif
+            , &scale_);
+        clog << "desired resolution: " << scaleToW_ << "x" << scaleToH_ << ", decode: " << retW << "x" << retH << " scale: " << FOURCC_name(scale_);
+        if (outW_)
+            clog << ", resize to " << outW_ << "x" << outH_;
+        clog << endl;
+    }
+    convertBufs_.reset(); // the old pool is alive until all frames are destroyed
+    if (convert::Target target; to(format_, &target) || outW_) {
+        convertBufs_ = make_shared<BufferPool>();
+        convertBufs_->reset(0, depth_ + 4);
+        const auto threads = convertThreads_ > 0 ? convertThreads_ : (int)std::min(thread::hardware_concurrency(), 8u);
+        if (!convertPool_ || convertPool_->threads() != threads)
+            convertPool_ = make_unique<convert::Pool>(threads);
+        clog << "resize or convert to " << VideoFormat(format_) << " via " << convert::isa() << endl;
     }
 
     MediaInfo info;
     to(info, clip_);
     info.video[0].codec.format = format_;
     clog << info << endl;
-    duration_ = info.video[0].duration;
     frames_ = info.video[0].frames;
+    for (auto t : tracks_) {
+        if (immersive_) // eyes, not multi-video tracks
+            break;
+        frames_ = std::min(frames_, info.video[t].frames); // lockstep
+    }
+    duration_ = int64_t(frames_ * (1000.0 / info.video[0].codec.frame_rate));
+    if (!immersive_ && (tracks_.size() > 1 || tracks_[0] > 0))
+        clog << tracks_.size() << " of " << trackCount << " video tracks, " << frames_ << " frames" << endl;
+    width_ = info.video[0].codec.width;
+    height_ = info.video[0].codec.height;
+    if (outW_) {
+        info.video[0].codec.width = outW_;
+        info.video[0].codec.height = outH_;
+    }
 
+    if (auto loading = Phase::Loading; !phase_.compare_exchange_strong(loading, Phase::Running)) // unload() is called
+        return false;
+    if (!info.audio.empty() && audioEnabled_ && !startAudio(info.audio[0]))
+        clog << "no audio output" << endl;
     changed(info); // may call seek for player.prepare(), duration_, frames_ and SetCallback() must be ready
     update(MediaStatus::Loaded);
 
+    {
+        const scoped_lock lock(attr_mtx_);
+        updateClipAttributes();
+    }
+    publishing_ = true;
     get_attributes(clip_.Get(), [this](const string& k, const string& v){
         setProperty(k, v);
     });
+    publishing_ = false;
+    progress_ = 0;
     updateBufferingProgress(0);
 
     if (state() == State::Stopped) // start with pause
         update(State::Running);
 
-    if (seeking_ == 0 && !readAt(0)) // prepare(pos) will seek in changed(MediaInfo)
-        return false;
+    if (waveform_)
+        startWaveform();
+
+    if (scrubScale_ && !refiner_.joinable()) {
+        refineStop_ = false;
+        refiner_ = thread(&BRawReader::refineLoop, this);
+    }
+
+    if (seeking_ == 0) { // prepare(pos) will seek in changed(MediaInfo)
+        resetSchedule(0);
+        if (!schedule())
+            return false;
+    }
 
     return true;
 }
 
 bool BRawReader::unload()
 {
+    if (phase_.exchange(Phase::Draining) == Phase::Draining) // by another thread
+        return false;
+    update(MediaStatus::Unloaded);
     {
-        const scoped_lock lock(unload_mtx_);
-        update(MediaStatus::Unloaded);
+        const scoped_lock lock(sched_mtx_);
+        halted_ = true;
+        ++epoch_;
+        reorder_.clear();
+        seekInFlight_ = false;
+        pendingSeek_.reset();
+        regrading_ = false;
+        regradePending_ = false;
     }
     if (!codec_) {
+        phase_ = Phase::Unloaded;
         update(State::Stopped);
         return false;
     }
-    // TODO: job->Abort();
+    stopRefine();
+    stopAudio();
+    stopWaveform();
+    abortStale();
     codec_->FlushJobs(); // must wait all jobs to safe release
-    frameAvailable(VideoFrame().setTimestamp(TimestampEOS)); // clear vo frames
-    const unique_lock res_lock(*res_mtx_.get());
-    if (processedRes_) {
-        MS_WARN(resMgr_->ReleaseResource(context_, cmdQueue_, processedRes_, processedType_));
-        processedRes_ = nullptr;
-    }
-    if (processedResCpu_) {
-        delete[] processedResCpu_;
-        processedResCpu_ = nullptr;
+    stopDelivery();
+    for (Processed p; results_.pop(p); p = {}) // unload() in delivery thread, or the thread is not started
+        processed(p.data, p.result, p.image.Get());
+    {
+        const scoped_lock lock(sched_mtx_);
+        retained_.clear(); // frames must be released before codec
     }
-    loaded_.reset();
+    cache_.clear();
+    frameAvailable(VideoFrame().setTimestamp(TimestampEOS)); // clear vo frames
+    staging_.reset(); // resources are released after frames are destroyed
+    sdk_.reset(); // frames alive keep sdk objects
     codec_.Reset();
+    {
+        const scoped_lock lock(attr_mtx_);
+        clipAttrs_.Reset();
+    }
+    clipEx_.Reset();
+    multi_.Reset();
+    immersive_.Reset();
+    audio_.Reset();
+    audioBufs_.reset(); // the old pool is alive until all frames are destroyed
     clip_.Reset();
+    flow1_.Reset();
+    if (resPool_)
+        resPool_->clear();
+    bitStreams_.reset(0, 0);
+    frameStates_.reset(0, 0);
+    decodedBufs_.reset(0, 0);
+    processedBufs_.reset(0, 0);
+    lutBufs_.reset(0, 0);
     frames_ = 0;
+    phase_ = Phase::Unloaded;
     update(State::Stopped);
     return true;
 }
@@ -488,7 +955,6 @@ bool BRawReader::seekTo(int64_t msec, SeekFlag flag, int id)
 {
     if (!clip_)
         return false;
-    // TODO: cancel running decodeProcessJob
     // TODO: seekCompelete if error later
     if (msec > duration_) // msec can be INT64_MAX, avoid overflow
         msec = duration_;
@@ -501,104 +967,904 @@ bool BRawReader::seekTo(int64_t msec, SeekFlag flag, int id)
         }
         index = (uint64_t)clamp<int64_t>((int64_t)index_ + msec, 0, frames_ - 1);
     }
+    seekAudio(index);
+    const bool step = test_flag(flag, SeekFlag::FromNow|SeekFlag::Frame);
+    const int direction = step ? (msec < 0 ? -1 : 1) : rate_direction_.load();
+    bool prefetched = false;
+    {
+        const scoped_lock lock(sched_mtx_);
+        if (const auto it = reorder_.find(index); step && !seekInFlight_ && direction == direction_ && stride_ == 1 && it != reorder_.end() && it->second.frame.isValid()) {
+            // frame step in the prefetched direction, deliver without decoding. frames behind are useless
+            if (direction > 0)
+                reorder_.erase(reorder_.begin(), it);
+            else
+                reorder_.erase(next(it), reorder_.end());
+            it->second.seek = true;
+            expect_ = index;
+            halted_ = false;
+            stepping_ = true;
+            prefetched = true;
+        }
+    }
+    if (prefetched) {
+        clog << "Step to prefetched index: " << index << " from " << index_ << endl;
+        index_ = index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
+        seekComplete(duration_ * index / frames_, id);
+        updateProgress();
+        requestDelivery();
+        schedule();
+        return true;
+    }
     seeking_++;
     clog << seeking_ << " Seek to index: " << index << " from " << index_<< endl;
-    updateBufferingProgress(0);
-    IBlackmagicRawJob* job = nullptr;
-    MS_ENSURE(clip_->CreateJobReadFrame(index, &job), false);
+    const SeekRequest req{index, id, !test_flag(flag & SeekFlag::IOCompleteCallback), scrubScale_ && !step, step, direction};
+    optional<SeekRequest> replaced;
+    bool queued = false;
+    {
+        const scoped_lock lock(sched_mtx_);
+        if (seekInFlight_) { // latest wins. submitted when the running seek job is completed or aborted
+            replaced = exchange(pendingSeek_, req);
+            queued = true;
+            ++epoch_; // drop the running seek job and prefetched frames
+            reorder_.clear();
+            halted_ = true;
+        } else {
+            seekInFlight_ = true;
+        }
+    }
+    if (replaced) {
+        seeking_--;
+        seekComplete(duration_ * replaced->index / frames_, replaced->id);
+    }
+    if (queued) {
+        abortStale();
+        updateProgress();
+        return true;
+    }
+    if (!submitSeek(req)) {
+        seeking_--;
+        return false;
+    }
+    return true;
+}
+
+bool BRawReader::submitSeek(const SeekRequest& req)
+{
+    const auto epoch = resetSchedule(req.index, true, req.direction, req.step);
+    abortStale();
+    updateProgress();
+    VideoFrame cached;
+    size_t bytes = 0;
+    const bool full = cache_.get({req.index, scale_, format_}, cached, &bytes);
+    if (full || (req.preview && cache_.get({req.index, scrubScale_, format_}, cached, &bytes))) {
+        seeking_--;
+        index_ = req.index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
+        seekComplete(duration_ * req.index / frames_, req.id);
+        complete(req.index, epoch, {std::move(cached), true, (uint32_t)bytes});
+        if (!full)
+            scheduleRefine(req.index, epoch);
+        return true;
+    }
     auto data = new UserData();
-    data->index = index;
-    data->seekId = id;
-    data->seekWaitFrame = !test_flag(flag & SeekFlag::IOCompleteCallback);
-    job->SetUserData(data);
-    MS_ENSURE(job->Submit(), (delete data, false));
+    data->index = req.index;
+    data->epoch = epoch;
+    data->seekId = req.id;
+    data->seekWaitFrame = req.waitFrame;
+    if (req.preview)
+        data->scale = scrubScale_;
+    if (!submitRead(data)) {
+        complete(req.index, epoch, {.seek = true});
+        return false;
+    }
+    if (req.preview)
+        scheduleRefine(req.index, epoch);
     return true;
 }
 
+void BRawReader::track(IBlackmagicRawJob* job, uint32_t epoch)
+{
+    if (!jobs_.track(job, epoch)) // the result is still dropped by epoch
+        clog << "too many jobs to track, job can not be aborted" << endl;
+}
+
+void BRawReader::untrack(IBlackmagicRawJob* job)
+{
+    jobs_.untrack(job);
+}
+
+void BRawReader::abortStale()
+{
+    vector<ComPtr<IBlackmagicRawJob>> jobs;
+    jobs_.forEachStale(epoch_, [&](IBlackmagicRawJob* job) {
+        jobs.emplace_back(job); // AddRef, job is released after untrack() in callbacks
+    });
+    for (const auto& job : jobs)
+        job->Abort(); // callback is still called
+}
+
+bool BRawReader::stale(uint32_t epoch) const
+{
+    return epoch != epoch_.load(memory_order_acquire);
+}
+
+void BRawReader::scheduleRefine(uint64_t index, uint32_t epoch)
+{
+    {
+        const scoped_lock lock(refine_mtx_);
+        refine_ = {index, epoch};
+        refineAt_ = chrono::steady_clock::now() + chrono::milliseconds(scrubDelay_); // seeking again delays refinement
+    }
+    refine_cv_.notify_one();
+}
+
+void BRawReader::refineLoop()
+{
+    unique_lock lock(refine_mtx_);
+    while (!refineStop_) {
+        if (!refine_) {
+            refine_cv_.wait(lock);
+            continue;
+        }
+        if (refine_cv_.wait_until(lock, refineAt_) != cv_status::timeout || chrono::steady_clock::now() < refineAt_)
+            continue;
+        const auto [index, epoch] = *refine_;
+        refine_.reset();
+        lock.unlock();
+        bool done = false; // playback continued or seeked
+        {
+            const scoped_lock sched_lock(sched_mtx_);
+            done = epoch != epoch_ || expect_ != advance(index) || !reorder_.empty();
+        }
+        if (!done)
+            readAt(index, epoch, scale_, true);
+        lock.lock();
+    }
+}
+
+void BRawReader::stopRefine()
+{
+    {
+        const scoped_lock lock(refine_mtx_);
+        refineStop_ = true;
+        refine_.reset();
+    }
+    refine_cv_.notify_one();
+    if (refiner_.joinable())
+        refiner_.join();
+}
+
 int64_t BRawReader::buffered(int64_t* bytes, float* percent) const
 {
-    return 0;
+    uint64_t count = 0;
+    int64_t size = 0;
+    uint64_t target = 0;
+    {
+        const scoped_lock lock(sched_mtx_);
+        for (const auto& [i, d] : reorder_) {
+            if (!d.frame.isValid())
+                continue;
+            count++;
+            size += d.bytes;
+        }
+        target = prefetchFrames();
+        if (target == 0)
+            target = depth_;
+    }
+    if (bytes)
+        *bytes = size;
+    if (percent)
+        *percent = std::min<float>(100.0f, 100.0f * (float)count / (float)target);
+    if (frames_ <= 0)
+        return 0;
+    return duration_ * count / frames_;
 }
 
 void BRawReader::ReadComplete(IBlackmagicRawJob* readJob, HRESULT result, IBlackmagicRawFrame* frame)
 { // immediately called
-    updateBufferingProgress(100);
     ComPtr<IBlackmagicRawJob> job;
     job.Attach(readJob);
+    untrack(readJob);
     uint64_t index = 0;
+    int64_t pts = 0;
+    uint32_t epoch = 0;
     int seekId = 0;
     bool seekWaitFrame = true;
+    uint8_t* bitStream = nullptr;
+    BlackmagicRawResolutionScale scale = 0;
+    bool refine = false;
+    bool regrade = false;
+    uint32_t videoTrack = 0;
+    uint32_t part = 0;
+    shared_ptr<Joint> joint;
     UserData* data = nullptr;
     if (SUCCEEDED(readJob->GetUserData((void**)&data)) && data) {
+        videoTrack = data->track;
+        part = data->part;
+        joint = std::move(data->joint);
         index = data->index;
+        pts = data->pts;
+        epoch = data->epoch;
         seekId = data->seekId;
         seekWaitFrame = data->seekWaitFrame;
+        bitStream = data->bitStream;
+        scale = data->scale;
+        refine = data->refine;
+        regrade = data->regrade;
         delete data;
     }
-    if (seekId > 0 && (!seekWaitFrame || FAILED(result))) {
+    const auto drop = [&]{ // decode job is not submitted
+        bitStreams_.put(bitStream);
+        if (regrade) {
+            const scoped_lock lock(sched_mtx_);
+            regrading_ = false;
+            regradePending_ = false;
+        }
+        completePart(joint, part, index, epoch, {.seek = seekId > 0, .refine = refine});
+    };
+    const bool superseded = stale(epoch); // by a new seek. maybe aborted
+    if (seekId > 0 && (!seekWaitFrame || FAILED(result) || superseded)) {
         seeking_--;
         seekComplete(duration_ * index / frames_, seekId);
     }
-    MS_WARN(result);
     if (FAILED(result)) {
-        dispatchEvent({ .error = result, .category = "decoder.video", .detail = "braw read error"});
-        return;
+        if (!superseded) {
+            MS_WARN(result);
+            dispatchEvent({ .error = result, .category = "decoder.video", .detail = "braw read error"});
+        }
+        return drop();
     }
-
-    if (index == frames_ - 1) {
-        update(MediaStatus::Loaded|MediaStatus::End); // Options::ContinueAtEnd
+    updateReadStats(frame);
+    if (superseded) // do not decode
+        return drop();
+    if (seekId == 0 && !refine && !regrade && !joint && late(index, pts)) {
+        dropped_++; // published by the delivery thread
+        return drop();
     }
 
-    MS_WARN(frame->SetResolutionScale(scale_));
-    MS_ENSURE(frame->SetResourceFormat(from(format_)));
-    IBlackmagicRawJob* decodeAndProcessJob = nullptr; // NOT ComPtr!
-    //IBlackmagicRawClipProcessingAttributes *a = {}; // TODO: color science gen, gamma, gamut(from IBlackmagicRawToneCurve->GetToneCurve())
-    MS_ENSURE(frame->CreateJobDecodeAndProcessFrame(nullptr, nullptr, &decodeAndProcessJob));
-    job = decodeAndProcessJob;
+    MS_WARN(frame->SetResolutionScale(scale ? scale : scale_));
+    MS_ENSURE(frame->SetResourceFormat(from(format_)), drop());
     data = new UserData();
     data->index = index;
+    data->pts = pts;
+    data->epoch = epoch;
     data->seekId = seekId;
     data->seekWaitFrame = seekWaitFrame;
+    data->bitStream = bitStream;
+    data->scale = scale;
+    data->refine = refine;
+    data->regrade = regrade;
+    data->decodeStart = chrono::steady_clock::now();
+    data->track = videoTrack;
+    data->part = part;
+    data->joint = joint;
 
     ComPtr<IBlackmagicRawMetadataIterator> mit;
     if (SUCCEEDED(frame->GetMetadataIterator(&mit)))
         read_metadata(mit.Get(), data->metadata);
     get_attributes(frame, data->attributes);
 
+    if (flow1_ && bitStream && submitDecode(frame, data))
+        return;
+    IBlackmagicRawJob* decodeAndProcessJob = nullptr; // NOT ComPtr!
+    //IBlackmagicRawClipProcessingAttributes *a = {}; // TODO: color science gen, gamma, gamut(from IBlackmagicRawToneCurve->GetToneCurve())
+    ComPtr<IBlackmagicRawClipProcessingAttributes> clipAttrs;
+    ComPtr<IBlackmagicRawFrameProcessingAttributes> frameAttrs;
+    processingAttributes(frame, clipAttrs, frameAttrs);
+    MS_ENSURE(frame->CreateJobDecodeAndProcessFrame(clipAttrs.Get(), frameAttrs.Get(), &decodeAndProcessJob), (delete data, drop()));
+    job = decodeAndProcessJob;
     decodeAndProcessJob->SetUserData(data);
+    track(decodeAndProcessJob, epoch);
     // will wait until submitted to gpu if using gpu decoder
-    MS_ENSURE(decodeAndProcessJob->Submit(), delete data);
+    MS_ENSURE(decodeAndProcessJob->Submit(), (untrack(decodeAndProcessJob), delete data, drop()));
+}
+
+bool BRawReader::prepareManual(IBlackmagicRawFrame* frame, UserData* data)
+{
+    data->frameState = frameStates_.get();
+    if (!data->frameState)
+        return false;
+    ComPtr<IBlackmagicRawClipProcessingAttributes> clipAttrs;
+    ComPtr<IBlackmagicRawFrameProcessingAttributes> frameAttrs;
+    processingAttributes(frame, clipAttrs, frameAttrs);
+    MS_ENSURE(flow1_->PopulateFrameStateBuffer(frame, clipAttrs.Get(), frameAttrs.Get(), data->frameState, (uint32_t)frameStates_.blockSize()), false);
+    uint32_t decodedBytes = 0;
+    uint32_t lutBytes = 0;
+    MS_ENSURE(flow1_->GetDecodedSizeBytes(data->frameState, &decodedBytes), false);
+    MS_ENSURE(flow1_->GetProcessedSizeBytes(data->frameState, &data->processedBytes), false);
+    MS_WARN(flow1_->GetPost3DLUTSizeBytes(data->frameState, &lutBytes));
+    if (!data->decoded) // not retained
+        data->decoded = decodedBufs_.get(decodedBytes);
+    if (allocator_) {
+        uint32_t w = 0, h = 0;
+        scaledSize(data->scale, &w, &h);
+        data->processed = allocator_->alloc(allocator_->opaque, data->processedBytes, w, h, (int)to(from(format_)));
+        data->external = data->processed;
+    }
+    if (!data->processed)
+        data->processed = processedBufs_.get(data->processedBytes);
+    if (lutBytes > 0)
+        data->post3DLUT = lutBufs_.get(lutBytes);
+    return data->decoded && data->processed && (lutBytes == 0 || data->post3DLUT); // false: in use by stale jobs
+}
+
+bool BRawReader::submitDecode(IBlackmagicRawFrame* frame, UserData* data)
+{
+    if (!prepareManual(frame, data)) { // decode and process in 1 job
+        releaseManual(data);
+        return false;
+    }
+    if (regrade_ > 0)
+        data->frame = frame;
+    IBlackmagicRawJob* decodeJob = nullptr; // NOT ComPtr!
+    MS_ENSURE(flow1_->CreateJobDecode(data->frameState, data->bitStream, data->decoded, &decodeJob), (releaseManual(data), false));
+    decodeJob->SetUserData(data);
+    track(decodeJob, data->epoch);
+    MS_ENSURE(decodeJob->Submit(), (untrack(decodeJob), decodeJob->Release(), data->frame.Reset(), releaseManual(data), false));
+    return true;
+}
+
+HRESULT BRawReader::submitProcess(UserData* data)
+{
+    IBlackmagicRawJob* processJob = nullptr; // NOT ComPtr!
+    MS_ENSURE(flow1_->CreateJobProcess(data->frameState, data->decoded, data->processed, data->post3DLUT, &processJob), __ms_hr__);
+    processJob->SetUserData(data);
+    track(processJob, data->epoch);
+    MS_ENSURE(processJob->Submit(), (untrack(processJob), processJob->Release(), __ms_hr__));
+    return S_OK;
+}
+
+void BRawReader::retain(UserData* data)
+{
+    const scoped_lock lock(sched_mtx_);
+    auto& r = retained_[data->index];
+    decodedBufs_.put(r.decoded);
+    r = {std::move(data->frame), exchange(data->decoded, nullptr), data->scale};
+    const auto center = (int64_t)index_;
+    while (retained_.size() > regrade_) { // drop the farthest
+        const auto first = retained_.begin();
+        const auto last = prev(retained_.end());
+        const auto it = center - (int64_t)first->first > (int64_t)last->first - center ? first : last;
+        decodedBufs_.put(it->second.decoded);
+        retained_.erase(it);
+    }
+}
+
+void BRawReader::regrade()
+{
+    if (!clip_ || !running())
+        return;
+    cache_.clear(); // processed with old attributes
+    const uint64_t index = index_;
+    Retained r;
+    int direction = 1;
+    bool running = false;
+    {
+        const scoped_lock lock(sched_mtx_);
+        if (seekInFlight_ || pendingSeek_) { // a new epoch drops the seek frame. run again when the seek is completed
+            regradePending_ = true;
+            return;
+        }
+        direction = direction_;
+        running = state() == State::Running;
+        if (!running) {
+            if (regrading_) { // coalesce slider changes
+                regradePending_ = true;
+                return;
+            }
+            regrading_ = true;
+            if (const auto it = retained_.find(index); it != retained_.end()) {
+                r = std::move(it->second);
+                retained_.erase(it);
+            }
+        }
+    }
+    if (running) { // drop prefetched frames, the following frames are processed with new attributes
+        const auto next = (int64_t)index + direction;
+        if (next < 0 || next >= frames_)
+            return;
+        resetSchedule(next, false, direction);
+        abortStale();
+        schedule();
+        return;
+    }
+    const auto epoch = resetSchedule(index, true, direction);
+    abortStale();
+    auto data = new UserData();
+    data->index = index;
+    data->epoch = epoch;
+    data->regrade = true;
+    if (r.decoded) { // process only
+        data->scale = r.scale;
+        data->frame = std::move(r.frame);
+        data->decoded = r.decoded;
+        data->decodedReady = true;
+        if (prepareManual(data->frame.Get(), data) && SUCCEEDED(submitProcess(data)))
+            return;
+        releaseManual(data);
+        data->frame.Reset();
+        data->decodedReady = false;
+    }
+    const auto fail = [&]{
+        {
+            const scoped_lock lock(sched_mtx_);
+            regrading_ = false;
+            regradePending_ = false;
+        }
+        complete(index, epoch, {});
+    };
+    if (!submitRead(data))
+        fail();
+}
+
+void BRawReader::releaseManual(UserData* data)
+{
+    frameStates_.put(exchange(data->frameState, nullptr));
+    decodedBufs_.put(exchange(data->decoded, nullptr));
+    if (data->external && data->processed)
+        allocator_->release(allocator_->opaque, exchange(data->processed, nullptr));
+    processedBufs_.put(exchange(data->processed, nullptr));
+    lutBufs_.put(exchange(data->post3DLUT, nullptr));
+}
+
+void BRawReader::DecodeComplete(IBlackmagicRawJob* decodeJob, HRESULT result)
+{ // manual flow only. processing of the previous frame runs in parallel
+    ComPtr<IBlackmagicRawJob> job;
+    job.Attach(decodeJob);
+    untrack(decodeJob);
+    UserData* data = nullptr;
+    if (FAILED(decodeJob->GetUserData((void**)&data)) || !data)
+        return;
+    bitStreams_.put(exchange(data->bitStream, nullptr));
+    if (FAILED(result))
+        return enqueue(data, result, nullptr);
+    data->decodedReady = true;
+    if (stale(data->epoch))
+        return enqueue(data, E_ABORT, nullptr);
+    if (const auto hr = submitProcess(data); FAILED(hr))
+        enqueue(data, hr, nullptr);
 }
 
 void BRawReader::ProcessComplete(IBlackmagicRawJob* procJob, HRESULT result, IBlackmagicRawProcessedImage* processedImage)
 {
     ComPtr<IBlackmagicRawJob> job;
     job.Attach(procJob);
+    untrack(procJob);
+    UserData* data = nullptr;
+    if (FAILED(procJob->GetUserData((void**)&data)))
+        data = nullptr;
+    enqueue(data, result, processedImage);
+}
+
+void BRawReader::enqueue(UserData* data, HRESULT result, IBlackmagicRawProcessedImage* processedImage)
+{
+    results_.push({data, result, processedImage});
+    requestDelivery();
+}
+
+void BRawReader::requestDelivery()
+{
+    wake_.fetch_add(1, memory_order_release);
+    wake_.notify_one();
+}
+
+void BRawReader::deliveryLoop()
+{
+    for (;;) {
+        const auto seq = wake_.load(memory_order_acquire);
+        for (Processed p; results_.pop(p); p = {})
+            batch_.push_back(std::move(p));
+        for (size_t i = 0; i < batch_.size() && i < depth_; ++i) // copies run while earlier results are processed, images are alive until then
+            batch_[i].staged = stage(batch_[i].image.Get());
+        for (auto& p : batch_) {
+            staged_ = p.staged;
+            processed(p.data, p.result, p.image.Get());
+            if (staged_ >= 0) // dropped before toFrame()
+                staging_->release(exchange(staged_, -1));
+        }
+        batch_.clear();
+        if (deliveryStop_) // all jobs are flushed, results_ is empty
+            return;
+        deliver();
+        publishStats();
+        wake_.wait(seq, memory_order_acquire);
+    }
+}
+
+void BRawReader::stopDelivery()
+{
+    deliveryStop_ = true;
+    requestDelivery();
+    if (deliverer_.joinable() && deliverer_.get_id() != this_thread::get_id())
+        deliverer_.join();
+}
+
+bool BRawReader::startAudio(AudioStreamInfo& info)
+{
+    audio_.Reset();
+    MS_ENSURE(clip_->QueryInterface(IID_IBlackmagicRawClipAudio, &audio_), false);
+    uint32_t bits = 0;
+    MS_ENSURE(audio_->GetAudioBitDepth(&bits), false);
+    audioBits_ = (int)bits;
+    audioChannels_ = info.codec.channels;
+    audioRate_ = info.codec.sample_rate;
+    audioSamples_ = info.frames;
+    if (audioChannels_ <= 0 || audioRate_ <= 0 || pcm::sampleBytes(audioBits_) < 1 || pcm::sampleBytes(audioBits_) > 4)
+        return false;
+    const auto out = audioOpt_;
+    if (out.toFloat)
+        info.codec.format = out.planar ? AudioFormat::SampleFormat::F32P : AudioFormat::SampleFormat::F32;
+    audioFormat_ = info.codec.format;
+    if (audioer_.joinable())
+        audioer_.join();
+    audioBufs_ = make_shared<BufferPool>();
+    audioBufs_->reset(0, out.ahead * (out.toFloat ? 2 : 1) + 1); // + samples being converted
+    audioSeek_ = -1;
+    audioStop_ = false;
+    audioer_ = thread(&BRawReader::audioLoop, this, out);
+    clog << "audio " << audioChannels_ << " channels " << audioRate_ << "Hz " << audioBits_ << " bits" << (out.toFloat ? " to float via " : "") << (out.toFloat ? pcm::isa() : "") << endl;
+    return true;
+}
+
+void BRawReader::seekAudio(uint64_t index)
+{
+    if (!audioer_.joinable() || frames_ <= 0)
+        return;
+    audioSeek_ = duration_ * (int64_t)index / frames_ * audioRate_ / 1000;
+    audioWake_.fetch_add(1, memory_order_release);
+    audioWake_.notify_one();
+}
+
+void BRawReader::stopAudio()
+{
+    audioStop_ = true;
+    audioWake_.fetch_add(1, memory_order_release);
+    audioWake_.notify_one();
+    if (audioer_.joinable())
+        audioer_.join();
+}
+
+void BRawReader::startWaveform()
+{
+    if (waveformer_.joinable() || !running() || !clip_)
+        return;
+    waveformStop_ = false;
+    waveformer_ = thread(&BRawReader::waveformLoop, this, url());
+}
+
+void BRawReader::stopWaveform()
+{
+    waveformStop_ = true;
+    if (waveformer_.joinable())
+        waveformer_.join();
+}
+
+void BRawReader::waveformLoop(string url)
+{
+    error_code ec;
+    const filesystem::path file(url);
+    auto key = detail::fnv1ah64::hash(url);
+    if (const auto size = filesystem::file_size(file, ec); !ec)
+        key = detail::fnv1ah64::hash(string_view((const char*)&size, sizeof(size)), key);
+    if (const auto t = filesystem::last_write_time(file, ec); !ec) {
+        const auto ticks = t.time_since_epoch().count();
+        key = detail::fnv1ah64::hash(string_view((const char*)&ticks, sizeof(ticks)), key);
+    }
+    const auto dir = waveformDir_.empty() ? filesystem::temp_directory_path(ec) / "mdk-braw-waveform" : filesystem::path(waveformDir_);
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.wf", (unsigned long long)key);
+    const auto path = (dir / name).string();
+    const auto ready = [&]{
+        {
+            const scoped_lock lock(waveformMtx_);
+            waveformFile_ = path;
+        }
+        waveformReady_ = true; // published by the delivery thread
+        requestDelivery();
+        dispatchEvent({.category = "audio.waveform", .detail = path});
+    };
+    waveform::Overview o;
+    const auto t0 = chrono::steady_clock::now();
+    if (waveform::load(path, key, o)) {
+        clog << "waveform from cache " << path << " in " << chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() << "ms" << endl;
+        return ready();
+    }
+    ComPtr<IBlackmagicRawClip> clip; // sequential reads do not contend with audio_ of playback
+    BStr bfile(url.data());
+    MS_ENSURE(codec_->OpenClip(bfile.get(), &clip));
+    ComPtr<IBlackmagicRawClipAudio> audio;
+    MS_ENSURE(clip->QueryInterface(IID_IBlackmagicRawClipAudio, &audio));
+    uint32_t channels = 0, rate = 0, bits = 0;
+    uint64_t samples = 0;
+    MS_ENSURE(audio->GetAudioChannelCount(&channels));
+    MS_ENSURE(audio->GetAudioSampleRate(&rate));
+    MS_ENSURE(audio->GetAudioBitDepth(&bits));
+    MS_ENSURE(audio->GetAudioSampleCount(&samples));
+    if (channels == 0 || pcm::sampleBytes(bits) < 1 || pcm::sampleBytes(bits) > 4)
+        return;
+    constexpr uint32_t kChunk = 1 << 16; // samples per channel of a read
+    vector<uint8_t> buf(size_t(kChunk) * channels * pcm::sampleBytes(bits));
+    vector<float> f(size_t(kChunk) * channels);
+    float* planes[] = {f.data()};
+    waveform::Builder b(channels, rate);
+    for (uint64_t pos = 0; pos < samples && !waveformStop_;) {
+        uint32_t n = 0;
+        MS_ENSURE(audio->GetAudioSamples(pos, buf.data(), (uint32_t)buf.size(), (uint32_t)std::min<uint64_t>(kChunk, samples - pos), &n, nullptr));
+        if (n == 0)
+            break;
+        pcm::toFloat(buf.data(), bits, channels, n, planes, false);
+        b.add(f.data(), n);
+        pos += n;
+    }
+    if (waveformStop_)
+        return;
+    o = b.finish();
+    clog << "waveform of " << o.samples << " samples in " << chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() << "ms" << endl;
+    MS_ENSURE(waveform::save(o, key, path) ? S_OK : E_FAIL);
+    ready();
+}
+
+// a plane of BRawAllocator, staging, converted or audio buffer
+class ExternalBuffer2D final : public Buffer2D
+{
+public:
+    ExternalBuffer2D(shared_ptr<uint8_t> owner, uint8_t* data, size_t stride, size_t size)
+        : owner_(std::move(owner)), data_(data), stride_(stride), size_(size)
+    {}
+    const uint8_t* constData() const override { return data_; }
+    uint8_t* data() override { return data_; }
+    size_t size() const override { return size_; }
+    size_t stride() const override { return stride_; }
+private:
+    shared_ptr<uint8_t> owner_; // released to allocator when all planes are destroyed
+    uint8_t* data_;
+    size_t stride_;
+    size_t size_;
+};
+
+void BRawReader::audioLoop(AudioOutput out)
+{
+    struct Chunk {
+        shared_ptr<uint8_t> data; // referenced by the delivered frame
+        uint32_t samples = 0;
+        int64_t pos = 0;
+    };
+    deque<Chunk> ahead;
+    const auto pool = audioBufs_;
+    const auto alloc = [&](size_t bytes) {
+        shared_ptr<uint8_t> owner;
+        if (auto p = pool->get(bytes))
+            owner.reset(p, [pool](uint8_t* p){ pool->put(p); });
+        else // all pooled buffers are referenced by frames
+            owner.reset(new uint8_t[bytes], default_delete<uint8_t[]>());
+        return owner;
+    };
+    const auto sampleBytes = (size_t)pcm::sampleBytes(audioBits_) * audioChannels_;
+    const auto read = [&](int64_t pos) {
+        Chunk c{.pos = pos};
+        const auto n = (uint32_t)std::min<int64_t>(out.chunk, audioSamples_ - pos);
+        const auto bytes = n * sampleBytes;
+        c.data = alloc(bytes);
+        MS_ENSURE(audio_->GetAudioSamples(pos, c.data.get(), (uint32_t)bytes, n, &c.samples, nullptr), (c.data.reset(), c));
+        if (!out.toFloat || c.samples == 0)
+            return c;
+        const auto f = alloc(c.samples * audioChannels_ * sizeof(float));
+        vector<float*> planes(out.planar ? audioChannels_ : 1);
+        for (size_t i = 0; i < planes.size(); ++i)
+            planes[i] = (float*)f.get() + i * c.samples;
+        pcm::toFloat(c.data.get(), audioBits_, audioChannels_, (int)c.samples, planes.data(), out.planar);
+        c.data = f;
+        return c;
+    };
+    int64_t pos = 0; // next sample to read
+    bool end = false; // eos is delivered, or read error
+    for (;;) {
+        const auto seq = audioWake_.load(memory_order_acquire);
+        if (audioStop_)
+            break;
+        if (const auto s = audioSeek_.exchange(-1); s >= 0) {
+            ahead.clear();
+            pos = std::clamp<int64_t>(s, 0, audioSamples_);
+            end = false;
+        }
+        while (!end && ahead.size() < out.ahead && pos < audioSamples_) {
+            auto c = read(pos);
+            if (!c.data || c.samples == 0) { // stop until the next seek
+                pos = audioSamples_;
+                break;
+            }
+            pos += c.samples;
+            ahead.push_back(std::move(c));
+        }
+        if (end || rate_direction_ < 0) { // no reverse audio
+            audioWake_.wait(seq, memory_order_acquire);
+            continue;
+        }
+        if (ahead.empty()) {
+            frameAvailable(AudioFrame().setTimestamp(TimestampEOS));
+            end = true;
+            continue;
+        }
+        const auto c = std::move(ahead.front());
+        ahead.pop_front();
+        AudioFrame frame(audioFormat_, audioChannels_, audioRate_, (int)c.samples);
+        const size_t bytesPerSample = out.toFloat ? sizeof(float) : pcm::sampleBytes(audioBits_);
+        const auto planeBytes = c.samples * bytesPerSample * (out.planar ? 1 : audioChannels_);
+        for (int i = 0; i < (out.planar ? audioChannels_ : 1); ++i) // no copy, the buffer is back to pool when the frame is destroyed
+            frame.addBuffer(make_shared<ExternalBuffer2D>(c.data, c.data.get() + i * planeBytes, planeBytes, planeBytes));
+        frame.setTimestamp(double(c.pos) / audioRate_);
+        frameAvailable(frame); // blocks if paused or enough audio is queued
+    }
+}
+
+void BRawReader::processed(UserData* data, HRESULT result, IBlackmagicRawProcessedImage* processedImage)
+{
     uint64_t index = 0;
+    uint32_t epoch = 0;
     int seekId = 0;
     bool seekWaitFrame = true;
-    UserData* data = nullptr;
-    if (SUCCEEDED(procJob->GetUserData((void**)&data)) && data) {
+    bool refine = false;
+    bool regraded = false;
+    BlackmagicRawResolutionScale scale = 0;
+    VideoFrame frame;
+    uint32_t bytes = 0;
+    chrono::steady_clock::time_point decodeStart;
+    uint32_t part = 0;
+    shared_ptr<Joint> joint;
+    if (data) {
+        part = data->part;
+        joint = std::move(data->joint);
+        regraded = data->regrade;
         index = data->index;
+        epoch = data->epoch;
         seekId = data->seekId;
         seekWaitFrame = data->seekWaitFrame;
+        refine = data->refine;
+        scale = data->scale;
+        decodeStart = data->decodeStart;
+        bitStreams_.put(data->bitStream);
+        if (data->processed && SUCCEEDED(result) && !stale(epoch)) { // manual flow, copy before buffers are reused, or wrap external buffer
+            frame = toFrame(*data);
+            bytes = data->processedBytes;
+        }
+        if (data->decodedReady && data->frame && !joint && !stale(epoch)) // regrade of multiple tracks reads again
+            retain(data);
+        releaseManual(data);
         delete data;
     }
-    index_ = index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
+    if (seekId > 0)
+        index_ = index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
     if (seekId > 0 && seekWaitFrame) {
         seeking_--;
-        const scoped_lock lock(unload_mtx_);
-        if (test_flag(mediaStatus() & MediaStatus::Loaded)) {
+        if (running()) {
             if (seeking_ > 0/* && seekId == 0*/) { // ?
                 seekComplete(duration_ * index / frames_, seekId); // may create a new seek
                 clog << "ProcessComplete drop @" << index << endl;
-                return;
+                return completePart(joint, part, index, epoch, {.seek = true});
             }
             seekComplete(duration_ * index / frames_, seekId); // may create a new seek
         }
     }
 
-    MS_ENSURE(result);// TODO: stop?
+    if (!stale(epoch))
+        MS_WARN(result);
+    if (SUCCEEDED(result) && processedImage)
+        frame = toFrame(processedImage);
+    if (frame.isValid()) {
+        frame.setTimestamp(double(duration_ * index / frames_) / 1000.0);
+        frame.setDuration((double)duration_/(double)frames_ / 1000.0);
+        if (processedImage)
+            MS_WARN(processedImage->GetResourceSizeBytes(&bytes));
+        if (bytes > 0 && !joint) // packed frames are not cached
+            cache_.put({index, scale ? scale : scale_, format_}, frame, bytes);
+        if (seekId == 0 && !refine && !regraded && part == 0 && !stale(epoch))
+            adapt(chrono::duration<double, milli>(chrono::steady_clock::now() - decodeStart).count(), scale);
+    }
+    updateMemoryStats();
+    completePart(joint, part, index, epoch, {std::move(frame), seekId > 0 || refine || regraded, bytes, refine, regraded});
+    if (regraded) {
+        bool again = false;
+        {
+            const scoped_lock lock(sched_mtx_);
+            regrading_ = false;
+            again = exchange(regradePending_, false);
+        }
+        if (again)
+            regrade();
+    }
+}
+
+// wrap planes of data without copy. braw planar formats are rgb, planes are in the same size
+static void add_planes(VideoFrame& frame, const shared_ptr<uint8_t>& data, size_t bytes, int height)
+{
+    const int planes = std::max(frame.format().planeCount(), 1);
+    const size_t size = bytes / planes;
+    for (int plane = 0; plane < planes; ++plane)
+        frame.addBuffer(make_shared<ExternalBuffer2D>(data, data.get() + plane * size, size / height, size));
+}
+
+// frames of the same format and size in 1 frame, side by side or top to bottom. invalid if any frame is not in cpu memory
+static VideoFrame pack(const VideoFrame& first, const vector<VideoFrame>& others, bool vertical, const shared_ptr<BufferPool>& pool)
+{
+    const auto fmt = first.format();
+    const int w = first.width();
+    const int h = first.height();
+    const int planes = std::max(fmt.planeCount(), 1);
+    const auto n = (int)others.size() + 1;
+    const auto frameAt = [&](int i) -> const VideoFrame& { return i == 0 ? first : others[i - 1]; };
+    for (int i = 0; i < n; ++i) {
+        const auto& f = frameAt(i);
+        if (!f.isValid() || f.format().format() != fmt.format() || f.width() != w || f.height() != h)
+            return {};
+        for (int p = 0; p < planes; ++p) {
+            if (!f.buffer(p)) // gpu
+                return {};
+        }
+    }
+    const int pw = vertical ? w : w * n;
+    const int ph = vertical ? h * n : h;
+    size_t stride[4]{}, size[4]{}, bytes = 0;
+    for (int p = 0; p < planes; ++p) {
+        stride[p] = fmt.bytesPerLine(pw, p);
+        size[p] = stride[p] * fmt.height(ph, p);
+        bytes += size[p];
+    }
+    shared_ptr<uint8_t> owner;
+    if (pool) {
+        if (auto p = pool->get(bytes))
+            owner.reset(p, [pool](uint8_t* p){ pool->put(p); });
+    }
+    if (!owner) // all pooled buffers are referenced by frames
+        owner.reset(new uint8_t[bytes], default_delete<uint8_t[]>());
+    VideoFrame frame(pw, ph, fmt);
+    auto dst = owner.get();
+    for (int p = 0; p < planes; ++p) {
+        const size_t line = fmt.bytesPerLine(w, p);
+        const int rows = fmt.height(h, p);
+        for (int i = 0; i < n; ++i) {
+            const auto b = frameAt(i).buffer(p);
+            auto d = dst + (vertical ? i * rows * stride[p] : i * line);
+            for (int y = 0; y < rows; ++y)
+                memcpy(d + y * stride[p], b->constData() + y * b->stride(), line);
+        }
+        frame.addBuffer(make_shared<ExternalBuffer2D>(owner, dst, stride[p], size[p]));
+        dst += size[p];
+    }
+    frame.setTimestamp(first.timestamp());
+    frame.setDuration(first.duration());
+    return frame;
+}
+
+StagingRing* BRawReader::staging(void* context, void* cmdQueue)
+{
+    const size_t window = depth_ + prefetchFrames();
+    const size_t slots = stagingSlots_ ? stagingSlots_ : window * tracks_.size() + depth_ + 4; // + staged batch and renderer
+    if (!staging_)
+        staging_ = make_shared<StagingRing>(resMgr_.Get(), dev_.Get(), context, cmdQueue, slots);
+    else
+        staging_->setCapacity(slots); // prefetch may change
+    return staging_.get();
+}
+
+int BRawReader::stage(IBlackmagicRawProcessedImage* processedImage)
+{
+    BlackmagicRawResourceType type = 0;
+    if (!processedImage || FAILED(processedImage->GetResourceType(&type)) || type != blackmagicRawResourceTypeBufferOpenCL)
+        return -1;
+    void* res = nullptr;
+    uint32_t sizeBytes = 0;
+    void* context = nullptr;
+    void* cmdQueue = nullptr;
+    void* host = nullptr;
+    if (FAILED(processedImage->GetResource(&res)) || FAILED(processedImage->GetResourceSizeBytes(&sizeBytes))
+        || FAILED(processedImage->GetResourceContextAndCommandQueue(&context, &cmdQueue)))
+        return -1;
+    if (SUCCEEDED(resMgr_->GetResourceHostPointer(context, cmdQueue, res, type, &host)) && host) // no copy in toFrame()
+        return -1;
+    return staging(context, cmdQueue)->enqueue(res, type, sizeBytes);
+}
+
+VideoFrame BRawReader::toFrame(IBlackmagicRawProcessedImage* processedImage)
+{
     uint32_t width = 0;
     uint32_t height = 0;
     uint32_t sizeBytes = 0;
@@ -606,13 +1872,13 @@ void BRawReader::ProcessComplete(IBlackmagicRawJob* procJob, HRESULT result, IBl
     void* res = nullptr;
     BlackmagicRawResourceFormat f;
 
-    MS_ENSURE(processedImage->GetWidth(&width));
-    MS_ENSURE(processedImage->GetHeight(&height));
-    MS_ENSURE(processedImage->GetResourceSizeBytes(&sizeBytes));
-    MS_ENSURE(processedImage->GetResource(&res));
-    MS_ENSURE(processedImage->GetResourceFormat(&f));
+    MS_ENSURE(processedImage->GetWidth(&width), {});
+    MS_ENSURE(processedImage->GetHeight(&height), {});
+    MS_ENSURE(processedImage->GetResourceSizeBytes(&sizeBytes), {});
+    MS_ENSURE(processedImage->GetResource(&res), {});
+    MS_ENSURE(processedImage->GetResourceFormat(&f), {});
     BlackmagicRawResourceType type;
-    MS_ENSURE(processedImage->GetResourceType(&type));
+    MS_ENSURE(processedImage->GetResourceType(&type), {});
 
 
     const VideoFormat fmt = to(f);
@@ -621,51 +1887,49 @@ void BRawReader::ProcessComplete(IBlackmagicRawJob* procJob, HRESULT result, IBl
     if (type != blackmagicRawResourceTypeBufferCPU) {
         void* context = nullptr;
         void* cmdQueue = nullptr;
-        MS_ENSURE(processedImage->GetResourceContextAndCommandQueue(&context, &cmdQueue));
+        MS_ENSURE(processedImage->GetResourceContextAndCommandQueue(&context, &cmdQueue), {});
         if (copy_ || type == blackmagicRawResourceTypeBufferOpenCL || !pool_) {
             // iOS/macOS(debug): -[MTLToolsResource validateCPUWriteable]:135: failed assertion `resourceOptions (0x20) specify MTLResourceStorageModePrivate, which is not CPU accessible.'
             if (type != blackmagicRawResourceTypeBufferMetal)
                 MS_WARN(resMgr_->GetResourceHostPointer(context, cmdQueue, res, type, (void**)&imageData[0])); // metal can get host ptr?
-            if (!imageData[0]) { // cuda, ocl
-                if (type == blackmagicRawResourceTypeBufferOpenCL) {
-                    if (!processedRes_ && !processedResCpu_) {
-                        MS_ENSURE(resMgr_->CreateResource(context, cmdQueue, sizeBytes, type, blackmagicRawResourceUsageReadCPUWriteGPU, &processedRes_));
-                        processedResCpu_ = new uint8_t[sizeBytes];
-                    }
-                    MS_ENSURE(resMgr_->CopyResource(context, cmdQueue, res, type, processedRes_, type, sizeBytes, false));
-                    MS_ENSURE(resMgr_->CopyResource(context, cmdQueue, processedRes_, type, processedResCpu_, blackmagicRawResourceTypeBufferCPU, sizeBytes, false));
-                    imageData[0] = processedResCpu_;
-                } else {
-                    if (!processedRes_) {
-                        processedType_ = type;
-                        clog << "try CPU readable GPU writable memory for " << FOURCC_name(type) << endl;
-                        MS_ENSURE(resMgr_->CreateResource(context, cmdQueue, sizeBytes, type, blackmagicRawResourceUsageReadCPUWriteGPU, &processedRes_));
-                        MS_WARN(resMgr_->GetResourceHostPointer(context, cmdQueue, processedRes_, type, (void**)&imageData[0])); // why host ptr is null?
-                        if (!imageData[0]) {
-                            clog << "try CPU readable CPU writable memory for " << FOURCC_name(type) << endl;
-                            MS_WARN(resMgr_->ReleaseResource(context, cmdQueue, processedRes_, processedType_));
-                            MS_ENSURE(resMgr_->CreateResource(context, cmdQueue, sizeBytes, type, blackmagicRawResourceUsageReadCPUWriteCPU, &processedRes_)); // processed image is on cpu readable memory?
-                        }
-                    }
-                    MS_WARN(resMgr_->GetResourceHostPointer(context, cmdQueue, processedRes_, type, (void**)&imageData[0]));
-                    if (imageData[0])
-                        MS_ENSURE(resMgr_->CopyResource(context, cmdQueue, res, type, processedRes_, type, sizeBytes, false));
-                }
+            if (imageData[0]) {
+                if (reshape(width, height))
+                    return toFormat(imageData[0], sizeBytes / height, width, height);
+                frame.setBuffers(imageData);
+                return frame;
+            }
+            // cuda, ocl: copy to a staging slot not referenced by any frame, frames decoded in parallel copy to different slots
+            const auto ring = staging(context, cmdQueue);
+            const auto slot = exchange(staged_, -1);
+            auto host = ring->take(slot >= 0 ? slot : ring->enqueue(res, type, sizeBytes));
+            if (!host) {
+                clog << "no staging buffer for " << FOURCC_name(type) << ", all in use or copy error" << endl;
+                return {};
+            }
+            if (reshape(width, height)) // the slot is released after conversion
+                return toFormat(host.get(), sizeBytes / height, width, height);
+            if (cache_.capacity() > 0) { // cached frames must not hold slots
+                const shared_ptr<uint8_t> owned(new uint8_t[sizeBytes], default_delete<uint8_t[]>());
+                memcpy(owned.get(), host.get(), sizeBytes);
+                host = owned;
             }
     // TODO: less copy via [MTLBuffer newBufferWithBytesNoCopy:length:options:deallocator:] from VideoFrame.buffer(0)
-            //clog << FOURCC_name(type) << " processedRes_ " << processedRes_ << " res " << res << " imageData: " << (void*)imageData[0] << endl;
-            if (imageData[0])
-                frame.setBuffers(imageData);
+            add_planes(frame, host, sizeBytes, height);
+            return frame;
         }
-    } else { // cpu
-        imageData[0] = (uint8_t*)res;
-        frame.setBuffers(imageData);
+    } else { // cpu, no copy. the processed image is alive until all frames referencing it are destroyed
+        if (reshape(width, height))
+            return toFormat((const uint8_t*)res, sizeBytes / height, width, height);
+        processedImage->AddRef();
+        const shared_ptr<uint8_t> data((uint8_t*)res, [sdk = sdk_, processedImage](uint8_t*){
+            processedImage->Release(); // before sdk objects
+        });
+        add_planes(frame, data, sizeBytes, height);
+        return frame;
     }
     if (!imageData[0]) {
         if (type == blackmagicRawResourceTypeBufferCUDA) {
             processedImage->AddRef();
-            const weak_ptr<bool> wp = loaded_;
-            const weak_ptr<mutex> wm = res_mtx_;
             const CUDAResource cures{
                 .ptr = {res},
                 .width = (int)width,
@@ -673,14 +1937,8 @@ void BRawReader::ProcessComplete(IBlackmagicRawJob* procJob, HRESULT result, IBl
                 .format = fmt,
                 .context = context_,
                 .stream = cmdQueue_,
-                .unref = [=]{
-                    if (auto sm = wm.lock()) {
-                        const scoped_lock lock(*sm);
-                        auto sp = wp.lock();
-                        if (!sp || !*sp)
-                            return;
-                        processedImage->Release(); // invalid if braw objects are destroyed in unload()?
-                    }
+                .unref = [sdk = sdk_, processedImage]{
+                    processedImage->Release(); // before sdk objects
                 },
             };
             frame = VideoFrame::from(&pool_, cures);
@@ -698,39 +1956,406 @@ void BRawReader::ProcessComplete(IBlackmagicRawJob* procJob, HRESULT result, IBl
             bb.type = type;
             bb.device = dev_.Get();
             bb.resMgr = resMgr_.Get();
-            //auto dev = bb.device;
-            //auto resMgr = bb.resMgr;
-            //dev->AddRef();
-            //resMgr->AddRef();
             processedImage->AddRef();
-            auto nativeBuf = pool_->getBuffer(&bb, [=]{
-                //dev->Release();
-                //resMgr->Release();
-                processedImage->Release(); // invalid if braw objects are destroyed in unload()?
+            auto nativeBuf = pool_->getBuffer(&bb, [sdk = sdk_, processedImage]{ // sdk keeps device and resource manager alive
+                processedImage->Release();
             });
             frame.setNativeBuffer(nativeBuf);
         }
     }
 
-    frame.setTimestamp(double(duration_ * index / frames_) / 1000.0);
-    frame.setDuration((double)duration_/(double)frames_ / 1000.0);
+    return frame;
+}
+
+void BRawReader::scaledSize(BlackmagicRawResolutionScale scale, uint32_t* width, uint32_t* height) const
+{
+    uint32_t div = 1;
+    switch (scale ? scale : scale_) {
+    case blackmagicRawResolutionScaleHalf: div = 2; break;
+    case blackmagicRawResolutionScaleQuarter: div = 4; break;
+    case blackmagicRawResolutionScaleEighth: div = 8; break;
+    default: break;
+    }
+    *width = width_ / div;
+    *height = height_ / div;
+}
+
+VideoFrame BRawReader::toFrame(UserData& data)
+{
+    uint32_t width = 0, height = 0;
+    scaledSize(data.scale, &width, &height);
+    const VideoFormat fmt = to(from(format_));
+    if (reshape(width, height)) // processed buffer is released by releaseManual()
+        return toFormat(data.processed, data.processedBytes / height, width, height);
+    VideoFrame frame(width, height, fmt);
+    if (!data.external) {
+        const uint8_t* imageData[3] = {data.processed};
+        frame.setBuffers(imageData);
+        return frame;
+    }
+    const auto a = allocator_;
+    const shared_ptr<uint8_t> owner(exchange(data.processed, nullptr), [a](uint8_t* p){
+        a->release(a->opaque, p);
+    });
+    add_planes(frame, owner, data.processedBytes, height);
+    return frame;
+}
+
+bool BRawReader::reshape(uint32_t width, uint32_t height) const
+{
+    convert::Target target;
+    return to(format_, &target) || (outW_ && (width != outW_ || height != outH_));
+}
+
+VideoFrame BRawReader::toFormat(const uint8_t* data, size_t stride, uint32_t width, uint32_t height)
+{
+    const uint32_t w = outW_ ? outW_ : width;
+    const uint32_t h = outH_ ? outH_ : height;
+    convert::Target target;
+    const bool yuv = to(format_, &target);
+    const int bpc = channelBytes(format_);
+    auto layout = convert::Layout{1, {4 * (size_t)bpc * w}, {4 * (size_t)bpc * w * h}};
+    if (yuv)
+        layout = convert::layout(target, w, h);
+    const size_t bytes = layout.size[0] + layout.size[1] + layout.size[2];
+    shared_ptr<uint8_t> owner;
+    if (auto pool = convertBufs_; pool) {
+        if (auto p = pool->get(bytes))
+            owner.reset(p, [pool](uint8_t* p){ pool->put(p); });
+    }
+    if (!owner) // all pooled buffers are referenced by frames
+        owner.reset(new uint8_t[bytes], default_delete<uint8_t[]>());
+    uint8_t* planes[3] = {owner.get(), owner.get() + layout.size[0], owner.get() + layout.size[0] + layout.size[1]};
+    const auto pool = convertPool_.get();
+    const auto filter = resize_.value_or(convert::Filter::Bilinear); // scrub previews are resized too
+    const auto matrix = yuvMatrix_; // the same values for conversion and tags
+    const bool fullRange = yuvFullRange_;
+    if (!yuv)
+        convert::resize(data, stride, width, height, bpc, planes[0], layout.stride[0], w, h, filter, pool);
+    else if (w != width || h != height)
+        convert::rgba64(data, stride, width, height, w, h, filter, target, matrix, fullRange, planes, layout.stride, pool);
+    else
+        convert::rgba64(data, stride, width, height, target, matrix, fullRange, planes, layout.stride, pool);
+    VideoFrame frame(w, h, format_);
+    for (int i = 0; i < layout.planes; ++i)
+        frame.addBuffer(make_shared<ExternalBuffer2D>(owner, planes[i], layout.stride[i], layout.size[i]));
+    if (yuv && target != convert::Target::X2RGB10) { // ffmpeg names, renderers and encoders assume bt709 limited range if absent
+        frame.setMetaData("colorspace", matrix == convert::Matrix::BT601 ? "bt470bg" : matrix == convert::Matrix::BT2020 ? "bt2020nc" : "bt709");
+        frame.setMetaData("color_range", fullRange ? "pc" : "tv");
+    }
+    return frame;
+}
+
+uint32_t BRawReader::resetSchedule(uint64_t index, bool pending, int direction, bool step)
+{
+    const scoped_lock lock(sched_mtx_);
+    reorder_.clear();
+    direction_ = direction;
+    stepping_ = step;
+    stride_ = step ? 1 : stride(rate_);
+    expect_ = index;
+    next_ = pending ? advance(index) : index;
+    inflight_ = pending ? 1 : 0;
+    halted_ = false;
+    anchorPts_ = -1;
+    drops_ = 0;
+    return ++epoch_;
+}
+
+int BRawReader::stride(float rate) const
+{
+    if (duration_ <= 0 || frames_ <= 0)
+        return 1;
+    const auto fps = frames_ * 1000.0 / duration_;
+    const auto shown = displayFps_ > 0 ? std::min<double>(displayFps_, fps) : fps; // never more than 1x
+    return std::max(int(rate * fps / shown + 0.001), 1);
+}
+
+int64_t BRawReader::advance(int64_t index) const
+{
+    const auto i = index + direction_ * stride_;
+    const int64_t last = direction_ < 0 ? 0 : frames_ - 1;
+    if (index != last && (i - last) * direction_ > 0) // the last frame is required by EOS
+        return last;
+    return i;
+}
+
+bool BRawReader::schedule()
+{
+    vector<uint64_t> indices;
+    uint32_t epoch = 0;
+    BlackmagicRawResolutionScale scale = 0;
+    int hits = 0; // frames from cache_
+    {
+        const scoped_lock lock(sched_mtx_);
+        if (!stepping_ && (halted_ || state() != State::Running)) // stepping: prefetch for the next step even if paused
+            return true;
+        if (seeking_ > 0 || !running())
+            return true;
+        const auto window = depth_ + prefetchFrames();
+        scale = adaptiveScale_ ? adaptiveScale_.load() : scale_;
+        if (fastRate_ > 0 && rate_ >= fastRate_ && !stepping_ && scale != blackmagicRawResolutionScaleEighth)
+            scale = blackmagicRawResolutionScaleQuarter;
+        while (inflight_ < depth_ && inflight_ + reorder_.size() < window && next_ >= 0 && next_ < frames_) {
+            VideoFrame cached;
+            size_t bytes = 0;
+            if (cache_.get({(uint64_t)next_, scale, format_}, cached, &bytes)) {
+                reorder_[next_] = {std::move(cached), false, (uint32_t)bytes};
+                hits++;
+            } else {
+                indices.push_back(next_);
+                inflight_++;
+            }
+            next_ = advance(next_);
+        }
+        epoch = epoch_;
+    }
+    if (hits > 0)
+        requestDelivery();
+    for (auto i : indices) {
+        if (!readAt(i, epoch, scale)) {
+            const scoped_lock lock(sched_mtx_);
+            if (epoch == epoch_) {
+                inflight_--;
+                halted_ = true;
+                stepping_ = false;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t BRawReader::prefetchFrames() const
+{
+    if (duration_ <= 0)
+        return 0;
+    return prefetch_ * frames_ / duration_;
+}
 
-    const scoped_lock lock(unload_mtx_);
-    // FIXME: stop playback in onFrame() callback results in dead lock in braw(FlushJobs will wait this function finished)
-    if (seekId > 0) {
-        frameAvailable(VideoFrame(fmt).setTimestamp(frame.timestamp()));
+void BRawReader::complete(uint64_t index, uint32_t epoch, Decoded&& d)
+{
+    if ((!d.seek || d.refine || d.regrade) && stale(epoch)) // only a seek job updates the state of an old epoch, and epoch_ never goes back
+        return;
+    optional<SeekRequest> next;
+    bool accepted = false;
+    bool regradeAgain = false; // deferred by the seek
+    {
+        const scoped_lock lock(sched_mtx_);
+        if (d.refine) { // not counted in inflight_
+            if (epoch == epoch_ && expect_ == advance(index) && reorder_.empty() && d.frame.isValid()) {
+                expect_ = index;
+                halted_ = false; // deliverFrame() decides again
+                reorder_[index] = std::move(d);
+                accepted = true;
+            }
+        } else if (d.seek && !d.regrade) {
+            seekInFlight_ = false;
+            if (pendingSeek_) {
+                next = pendingSeek_;
+                pendingSeek_.reset();
+                seekInFlight_ = true;
+            } else if (!regrading_) {
+                regradeAgain = exchange(regradePending_, false);
+            }
+        }
+        if (!d.refine && epoch == epoch_ && ((int64_t)index - expect_) * direction_ >= 0) { // otherwise seek happened
+            inflight_--;
+            reorder_[index] = std::move(d);
+            accepted = true;
+        }
     }
-    bool accepted = frameAvailable(frame); // false: out of loop range and begin a new loop
-    if ((index == frames_ - 1 && seeking_ == 0 && accepted) || !test_flag(mediaStatus() & MediaStatus::Loaded)) {
-        accepted = frameAvailable(VideoFrame().setTimestamp(TimestampEOS));
-        if (accepted && !test_flag(options() & Options::ContinueAtEnd)) {
-            thread([this]{ unload(); }).detach(); // unload() in current thread will result in dead lock
+    if (next) {
+        if (!submitSeek(*next)) {
+            seeking_--;
+            seekComplete(duration_ * next->index / frames_, next->id);
         }
         return;
     }
-    // frameAvailable() will wait in pause state, and return when seeking, do not read the next index
-    if (accepted && seeking_ == 0 && state() == State::Running && test_flag(mediaStatus() & MediaStatus::Loaded)) // seeking_ > 0: new seek created by seekComplete when continuously seeking
-        readAt(index + 1);
+    if (accepted) {
+        updateProgress();
+        requestDelivery();
+        schedule(); // the delivery thread may be waiting in pause state, continue prefetching
+    }
+    if (regradeAgain)
+        regrade();
+}
+
+void BRawReader::deliver()
+{
+    unique_lock lock(sched_mtx_);
+    for (auto it = reorder_.find(expect_); !halted_ && it != reorder_.end(); it = reorder_.find(expect_)) {
+        auto d = reorder_.extract(it);
+        const uint32_t epoch = epoch_;
+        const auto direction = direction_;
+        lock.unlock();
+        if (auto& t = d.mapped(); !t.tracks.empty() && t.frame.isValid()) {
+            if (auto packed = pack(t.frame, t.tracks, immersive_ ? stereo_.value_or(false) : tracksVertical_, packBufs_); packed.isValid())
+                t.frame = std::move(packed);
+            else
+                clog << "can not pack video tracks of index " << d.key() << ", deliver track " << tracks_[0] << " only" << endl;
+        }
+        updateProgress();
+        const bool more = deliverFrame(d.key(), d.mapped().frame, d.mapped().seek, direction);
+        lock.lock();
+        if (epoch != epoch_) // seek in frameAvailable(), expect_ is reset
+            continue;
+        expect_ = advance(expect_);
+        if (!more) {
+            halted_ = true;
+            continue;
+        }
+        lock.unlock();
+        schedule();
+        lock.lock();
+    }
+}
+
+void BRawReader::updateCacheStats()
+{
+    if (cache_.capacity() == 0)
+        return;
+    if (const auto n = cache_.hits(); cacheHits_.exchange(n) != n)
+        setProperty("cache.hits", std::to_string(n));
+    if (const auto n = cache_.misses(); cacheMisses_.exchange(n) != n)
+        setProperty("cache.misses", std::to_string(n));
+}
+
+void BRawReader::updateReadStats(IBlackmagicRawFrame* frame)
+{
+    ComPtr<IBlackmagicRawFrameEx> frameEx;
+    if (FAILED(frame->QueryInterface(IID_IBlackmagicRawFrameEx, &frameEx)))
+        return;
+    uint32_t bytes = 0;
+    MS_ENSURE(frameEx->GetBitStreamSizeBytes(&bytes));
+    lastReadBytes_ = bytes;
+    readBytes_ += bytes;
+}
+
+void BRawReader::publishStats()
+{
+    updateCacheStats();
+    if (const auto n = readBytes_.load(); readPublished_ != n) {
+        readPublished_ = n;
+        setProperty("read.bytes", std::to_string(lastReadBytes_)); // of the last frame, less than full resolution bitstream if scaled
+        setProperty("read.total", std::to_string(n));
+    }
+    if (const auto n = dropped_.load(); droppedPublished_ != n) {
+        droppedPublished_ = n;
+        setProperty("frames.dropped", std::to_string(n));
+    }
+    if (waveformReady_.exchange(false)) {
+        const scoped_lock lock(waveformMtx_);
+        setProperty("waveform.file", waveformFile_);
+    }
+}
+
+bool BRawReader::late(uint64_t index, int64_t pts)
+{
+    if (deadline_ < 0 || presenting_)
+        return false;
+    const scoped_lock lock(sched_mtx_);
+    if (stepping_ || anchorPts_ < 0 || index == (direction_ < 0 ? 0 : uint64_t(frames_ - 1))) // the last frame is required by EOS
+        return false;
+    if (drops_ >= max<int64_t>(frames_ * 500 / duration_, 1)) { // still show a frame every 0.5s if decoding is always slower than real time
+        drops_ = 0;
+        return false;
+    }
+    const auto due = anchorTime_ + chrono::duration<double, milli>(abs(pts - anchorPts_) / rate_ + deadline_);
+    if (chrono::steady_clock::now() <= due)
+        return false;
+    drops_++;
+    return true;
+}
+
+void BRawReader::adapt(double ms, BlackmagicRawResolutionScale scale)
+{
+    static const BlackmagicRawResolutionScale kScales[] = {blackmagicRawResolutionScaleFull, blackmagicRawResolutionScaleHalf, blackmagicRawResolutionScaleQuarter};
+    const auto level = [](BlackmagicRawResolutionScale s) {
+        const auto it = find(begin(kScales), end(kScales), s);
+        return it == end(kScales) ? size(kScales) - 1 : size_t(it - begin(kScales)); // eighth: never adapted
+    };
+    const auto current = adaptiveScale_ ? adaptiveScale_.load() : scale_;
+    if (!adaptive_ || !running() || (scale ? scale : scale_) != current) // in flight before the last change
+        return;
+    const auto cost = ms / max(depth_, 1u); // jobs run in parallel
+    adaptCost_ = adaptSamples_++ == 0 ? cost : adaptCost_ * 0.9 + cost * 0.1;
+    const auto frameMs = (double)duration_ / (double)frames_;
+    auto l = level(current);
+    if (adaptSamples_ >= 8 && adaptCost_ > frameMs && l + 1 < size(kScales)) {
+        l++;
+    } else if (adaptSamples_ >= max(30, int(2000 / frameMs)) && adaptCost_ < frameMs / 4 && l > level(scale_)) { // hysteresis: lower scale costs ~1/4
+        l--;
+    } else {
+        return;
+    }
+    adaptSamples_ = 0;
+    adaptiveScale_ = kScales[l] == scale_ ? 0 : kScales[l];
+    const char* names[] = {"1", "1/2", "1/4"};
+    clog << "adaptive scale " << names[l] << ". " << adaptCost_ << "ms/frame, frame duration " << frameMs << "ms" << endl;
+    dispatchEvent({.category = "decoder.video.scale", .detail = names[l]});
+}
+
+void BRawReader::updateMemoryStats()
+{
+    if (!resPool_)
+        return;
+    size_t i = 0;
+    for (auto usage : {blackmagicRawResourceUsageReadCPUWriteCPU, blackmagicRawResourceUsageReadGPUWriteGPU, blackmagicRawResourceUsageReadGPUWriteCPU, blackmagicRawResourceUsageReadCPUWriteGPU}) {
+        if (const auto n = resPool_->bytes(usage); memStats_[i++].exchange(n) != n)
+            setProperty("memory." + FOURCC_name(usage), std::to_string(n));
+    }
+    if (const auto n = resPool_->cachedBytes(); memStats_[i].exchange(n) != n)
+        setProperty("memory.cached", std::to_string(n));
+}
+
+void BRawReader::updateProgress()
+{
+    float percent = 0;
+    buffered(nullptr, &percent);
+    if (progress_.exchange((int)percent) != (int)percent)
+        updateBufferingProgress((int)percent);
+}
+
+bool BRawReader::deliverFrame(uint64_t index, const VideoFrame& frame, bool seek, int direction)
+{
+    if (!frame.isValid()) // read or decode error
+        return true;
+    index_ = index;
+    const uint64_t last = direction < 0 ? 0 : frames_ - 1;
+    if (index == last) {
+        update(MediaStatus::Loaded|MediaStatus::End); // Options::ContinueAtEnd
+    }
+
+    if (!running()) // unload() waits for the delivery thread before destroying frames
+        return false;
+    if (seek) {
+        frameAvailable(VideoFrame(frame.format()).setTimestamp(frame.timestamp()));
+    }
+    presenting_ = true;
+    const auto t0 = chrono::steady_clock::now();
+    const bool accepted = frameAvailable(frame); // false: out of loop range and begin a new loop
+    presenting_ = false;
+    if (deadline_ >= 0) {
+        const auto now = chrono::steady_clock::now();
+        const auto pts = duration_ * (int64_t)index / frames_;
+        const auto frameMs = (double)duration_ / (double)frames_ / rate_;
+        const scoped_lock lock(sched_mtx_);
+        drops_ = 0;
+        // blocked by the renderer: presented no earlier than now. otherwise keep the clock so the following late frames are dropped
+        if (anchorPts_ < 0 || (now - t0 > chrono::duration<double, milli>(frameMs / 2) && now > anchorTime_ + chrono::duration<double, milli>(abs(pts - anchorPts_) / rate_))) {
+            anchorTime_ = now;
+            anchorPts_ = pts;
+        }
+    }
+    if ((index != last || seeking_ > 0 || !accepted) && running()) {
+        // frameAvailable() will wait in pause state, and return when seeking, do not read the next index
+        return accepted && seeking_ == 0 && state() == State::Running; // seeking_ > 0: new seek created by seekComplete when continuously seeking
+    }
+    if (!frameAvailable(VideoFrame().setTimestamp(TimestampEOS)) || test_flag(options() & Options::ContinueAtEnd) || !running())
+        return false;
+    unload(); // in delivery thread, sdk callbacks never wait for it, so FlushJobs() does not dead lock
+    return false;
 }
 
 bool BRawReader::setupPipeline()
@@ -830,19 +2455,218 @@ bool BRawReader::setupPipeline()
     return true;
 }
 
-bool BRawReader::readAt(uint64_t index)
+bool BRawReader::submitRead(UserData* data)
+{
+    const auto submit = [this](UserData* d) {
+        IBlackmagicRawJob* job = nullptr;
+        MS_ENSURE(createReadJob(d, &job), (bitStreams_.put(d->bitStream), delete d, false));
+        job->SetUserData(d);
+        track(job, d->epoch);
+        MS_ENSURE(job->Submit(), (untrack(job), bitStreams_.put(d->bitStream), delete d, false));
+        return true;
+    };
+    data->track = tracks_[0];
+    if (tracks_.size() == 1)
+        return submit(data);
+    const auto index = data->index;
+    const auto epoch = data->epoch;
+    auto joint = make_shared<Joint>();
+    joint->parts.resize(tracks_.size());
+    for (uint32_t i = 0; i < tracks_.size(); ++i) {
+        UserData* d = data;
+        if (i + 1 < tracks_.size()) {
+            d = new UserData(*data);
+        } else {
+            data = nullptr;
+        }
+        d->track = tracks_[i];
+        d->part = i;
+        d->joint = joint;
+        if (i > 0) { // seek and regrade states are of the 1st part
+            d->seekId = 0;
+            d->regrade = false;
+        }
+        {
+            const scoped_lock lock(joint->mtx);
+            joint->pending++;
+        }
+        if (submit(d))
+            continue;
+        if (i == 0) { // as if nothing is submitted
+            delete data;
+            return false;
+        }
+        completePart(joint, (int)i, index, epoch, {}); // the track is skipped
+    }
+    completePart(joint, -1, index, epoch, {});
+    return true;
+}
+
+void BRawReader::completePart(const shared_ptr<Joint>& joint, int part, uint64_t index, uint32_t epoch, Decoded&& d)
+{
+    if (!joint)
+        return complete(index, epoch, std::move(d));
+    Decoded all;
+    {
+        const scoped_lock lock(joint->mtx);
+        if (part >= 0)
+            joint->parts[part] = std::move(d);
+        if (--joint->pending > 0)
+            return;
+        all = std::move(joint->parts[0]);
+        for (size_t i = 1; i < joint->parts.size(); ++i) {
+            all.bytes += joint->parts[i].bytes;
+            all.tracks.push_back(std::move(joint->parts[i].frame));
+        }
+    }
+    complete(index, epoch, std::move(all));
+}
+
+bool BRawReader::readAt(uint64_t index, uint32_t epoch, BlackmagicRawResolutionScale scale, bool refine)
 {
-    if (!test_flag(mediaStatus(), MediaStatus::Loaded))
+    if (!running())
         return false;
     if (!clip_)
         return false;
-    IBlackmagicRawJob* nextJob = nullptr;
-    MS_ENSURE(clip_->CreateJobReadFrame(index, &nextJob), false);
     auto data = new UserData();
     data->index = index;
-    nextJob->SetUserData(data);
-    MS_ENSURE(nextJob->Submit(), (delete data, false));
-    return true;
+    data->pts = duration_ * index / frames_;
+    data->epoch = epoch;
+    data->scale = scale;
+    data->refine = refine;
+    return submitRead(data);
+}
+
+HRESULT BRawReader::createReadJob(UserData* data, IBlackmagicRawJob** job)
+{
+    HRESULT hr = E_FAIL;
+    if (clipEx_)
+        data->bitStream = bitStreams_.get(); // nullptr if all buffers are in use
+    if (immersive_) { // left and right eyes
+        uint32_t bytes = 0;
+        if (data->bitStream && (FAILED(immersive_->GetImmersiveBitStreamSizeBytes(data->track, data->index, &bytes)) || bytes > bitStreams_.blockSize()))
+            bitStreams_.put(exchange(data->bitStream, nullptr));
+        hr = immersive_->CreateJobImmersiveReadFrameEx(data->track, data->index, data->bitStream, data->bitStream ? (uint32_t)bitStreams_.blockSize() : 0, job);
+    } else if (data->track > 0 && multi_) {
+        uint32_t bytes = 0; // max size is of track 0
+        if (data->bitStream && (FAILED(multi_->GetBitStreamSizeBytes(data->track, data->index, &bytes)) || bytes > bitStreams_.blockSize()))
+            bitStreams_.put(exchange(data->bitStream, nullptr));
+        if (data->bitStream)
+            hr = multi_->CreateJobReadFrameEx(data->track, data->index, data->bitStream, (uint32_t)bitStreams_.blockSize(), job);
+        else
+            hr = multi_->CreateJobReadFrame(data->track, data->index, job);
+    } else if (data->bitStream) {
+        hr = clipEx_->CreateJobReadFrame(data->index, data->bitStream, (uint32_t)bitStreams_.blockSize(), job);
+    } else {
+        hr = clip_->CreateJobReadFrame(data->index, job);
+    }
+    if (FAILED(hr))
+        return hr;
+    if (const auto scale = data->scale ? data->scale : scale_; scale != blackmagicRawResolutionScaleFull) { // read only the data required by the scale
+        ComPtr<IBlackmagicRawReadJobHints> hints;
+        if (SUCCEEDED((*job)->QueryInterface(IID_IBlackmagicRawReadJobHints, &hints)))
+            MS_WARN(hints->SetReaderResolutionScale(scale));
+    }
+    return hr;
+}
+
+static var_ptr to_variant(const VARIANT& type, const string& val)
+{
+    switch (type.vt) {
+    case blackmagicRawVariantTypeS16: return make_v((int16_t)strtol(val.data(), nullptr, 10));
+    case blackmagicRawVariantTypeU16: return make_v((uint16_t)strtoul(val.data(), nullptr, 10));
+    case blackmagicRawVariantTypeS32: return make_v((int32_t)strtol(val.data(), nullptr, 10));
+    case blackmagicRawVariantTypeU32: return make_v((uint32_t)strtoul(val.data(), nullptr, 10));
+    case blackmagicRawVariantTypeFloat32: return make_v(strtof(val.data(), nullptr));
+    case blackmagicRawVariantTypeString: return make_v(val);
+    default: return {};
+    }
+}
+
+bool BRawReader::setAttribute(const string& key, const string& val)
+{
+    if (key.size() != 4)
+        return false;
+    const uint32_t id = (uint32_t(uint8_t(key[0])) << 24) | (uint32_t(uint8_t(key[1])) << 16) | (uint32_t(uint8_t(key[2])) << 8) | uint32_t(uint8_t(key[3]));
+    const scoped_lock lock(attr_mtx_);
+    switch (id) {
+    case blackmagicRawFrameProcessingAttributeWhiteBalanceKelvin:
+    case blackmagicRawFrameProcessingAttributeWhiteBalanceTint:
+    case blackmagicRawFrameProcessingAttributeExposure:
+    case blackmagicRawFrameProcessingAttributeISO:
+    case blackmagicRawFrameProcessingAttributeAnalogGain: {
+        const auto it = frameOverrides_.find(id);
+        if (it != frameOverrides_.end() && it->second == val)
+            return false;
+        frameOverrides_[id] = val;
+    }
+        return true;
+    case blackmagicRawClipProcessingAttributeColorScienceGen:
+    case blackmagicRawClipProcessingAttributeGamma:
+    case blackmagicRawClipProcessingAttributeGamut:
+    case blackmagicRawClipProcessingAttributeToneCurveContrast:
+    case blackmagicRawClipProcessingAttributeToneCurveSaturation:
+    case blackmagicRawClipProcessingAttributeToneCurveMidpoint:
+    case blackmagicRawClipProcessingAttributeToneCurveHighlights:
+    case blackmagicRawClipProcessingAttributeToneCurveShadows:
+    case blackmagicRawClipProcessingAttributeToneCurveVideoBlackLevel:
+    case blackmagicRawClipProcessingAttributeToneCurveBlackLevel:
+    case blackmagicRawClipProcessingAttributeToneCurveWhiteLevel:
+    case blackmagicRawClipProcessingAttributeHighlightRecovery:
+    case blackmagicRawClipProcessingAttributeAnalogGainIsConstant:
+    case blackmagicRawClipProcessingAttributeAnalogGain:
+    case blackmagicRawClipProcessingAttributePost3DLUTMode:
+    case blackmagicRawClipProcessingAttributeGamutCompressionEnable:
+        break;
+    default: // not a processing attribute, or read only, e.g. lut data
+        return false;
+    }
+    if (const auto it = clipOverrides_.find(id); it != clipOverrides_.end() && it->second == val)
+        return false;
+    clipOverrides_[id] = val;
+    if (!clip_) // validated in load()
+        return true;
+    updateClipAttributes();
+    return clipOverrides_.contains(id);
+}
+
+void BRawReader::updateClipAttributes()
+{
+    clipAttrs_.Reset();
+    if (clipOverrides_.empty())
+        return;
+    ComPtr<IBlackmagicRawClipProcessingAttributes> a;
+    MS_ENSURE(clip_->CloneClipProcessingAttributes(&a));
+    for (auto it = clipOverrides_.begin(); it != clipOverrides_.end();) {
+        ScopedVariant v;
+        var_ptr nv;
+        if (SUCCEEDED(a->GetClipAttribute(it->first, &v)))
+            nv = to_variant(v, it->second);
+        if (!nv) {
+            clog << "not a clip attribute: " << FOURCC_name(it->first) << endl;
+            it = clipOverrides_.erase(it);
+            continue;
+        }
+        MS_WARN(a->SetClipAttribute(it->first, nv.get()));
+        ++it;
+    }
+    clipAttrs_ = a;
+}
+
+void BRawReader::processingAttributes(IBlackmagicRawFrame* frame, ComPtr<IBlackmagicRawClipProcessingAttributes>& clipAttrs, ComPtr<IBlackmagicRawFrameProcessingAttributes>& frameAttrs)
+{
+    const scoped_lock lock(attr_mtx_);
+    clipAttrs = clipAttrs_;
+    if (frameOverrides_.empty())
+        return;
+    MS_ENSURE(frame->CloneFrameProcessingAttributes(&frameAttrs));
+    for (const auto& [id, val] : frameOverrides_) {
+        ScopedVariant v;
+        if (FAILED(frameAttrs->GetFrameAttribute(id, &v)))
+            continue;
+        if (const auto nv = to_variant(v, val))
+            MS_WARN(frameAttrs->SetFrameAttribute(id, nv.get()));
+    }
 }
 
 void BRawReader::parseDecoderOptions()
@@ -862,12 +2686,89 @@ void BRawReader::onPropertyChanged(const std::string& key, const std::string& va
 {
     const auto k = detail::fnv1ah32::hash(key);
     switch (k) {
-    case "format"_svh:
+    case "format"_svh: // sdk formats, or nv12, p010le, yuv422p10le, x2rgb10le converted from rgba64le by reader
         format_ = VideoFormat::fromName(val.data());
         return;
+    case "yuv.matrix"_svh: // 601, 709, 2020 for yuv formats
+        yuvMatrix_ = val == "601" ? convert::Matrix::BT601 : val == "2020" ? convert::Matrix::BT2020 : convert::Matrix::BT709;
+        return;
+    case "yuv.range"_svh: // limited or full
+        yuvFullRange_ = val == "full";
+        return;
+    case "convert.threads"_svh: // threads converting a frame. 0: auto
+        convertThreads_ = std::max(stoi(val), 0);
+        return;
     case "threads"_svh:
         threads_ = stoi(val);
         return;
+    case "scrub"_svh: // preview scale of seeks: 1/4, 1/8. 0: disabled
+        if (val.starts_with("1/"))
+            scrubScale_ = atoi(&val[2]) >= 6 ? blackmagicRawResolutionScaleEighth : blackmagicRawResolutionScaleQuarter;
+        else
+            scrubScale_ = 0;
+        return;
+    case "scrub.delay"_svh: // ms
+        scrubDelay_ = std::max(stoll(val), 0LL);
+        return;
+    case "rate"_svh: { // playback rate. < 0: reverse playback
+        const int direction = stof(val) < 0 ? -1 : 1;
+        bool restart = rate_direction_.exchange(direction) != direction;
+        if (const auto rate = std::max(abs(stof(val)), 0.01f); rate_.exchange(rate) != rate) {
+            const scoped_lock lock(sched_mtx_);
+            anchorPts_ = -1; // restart presentation clock
+            restart |= !stepping_ && stride(rate) != stride_; // shown frames changed
+        }
+        if (!restart || !clip_)
+            return;
+        const auto index = clamp<int64_t>((int64_t)index_ + direction * stride(rate_), 0, frames_ - 1);
+        if (index == (int64_t)index_)
+            return;
+        resetSchedule(index, false, direction);
+        abortStale();
+        schedule();
+        if (direction > 0)
+            seekAudio(index);
+    }
+        return;
+    case "resource.pool"_svh: // recycle cpu resources of sdk by size class, count live bytes in properties memory.rcwc, memory.rgwg etc.
+        resourcePool_ = stoi(val) != 0;
+        return;
+    case "hugepage"_svh: // huge pages for large cpu resources of resource.pool
+        hugePages_ = stoi(val) != 0;
+        return;
+    case "staging"_svh: // max staging buffers of gpu copy mode, recycled when frames are released. 0: depth + 4
+        stagingSlots_ = std::max(stoi(val), 0);
+        return;
+    case "regrade"_svh: // decoded frames kept for processing attribute changes in flow=manual. 0: decode again
+        regrade_ = std::max(stoi(val), 0);
+        return;
+    case "allocator"_svh: { // address of BRawAllocator for flow=manual, alive until the reader is unloaded and all frames are released
+        char* end = nullptr;
+        const auto a = (const BRawAllocator*)(intptr_t)strtoull(val.data(), &end, 0);
+        allocator_ = nullptr;
+        if (!a || end != val.data() + val.size())
+            clog << "invalid allocator address: " << val << endl;
+        else if (!a->alloc || !a->release)
+            clog << "BRawAllocator.alloc and release are required" << endl;
+        else
+            allocator_ = a;
+    }
+        return;
+    case "flow"_svh: // manual: separated decode and process jobs with pooled buffers, cpu pipeline only
+        manual_ = val == "manual";
+        return;
+    case "cache"_svh: // MB of processed frames, keyed by index, scale and format. hits and misses are in properties cache.hits and cache.misses
+        cache_.setCapacity((size_t)std::max(stoll(val), 0LL) << 20);
+        return;
+    case "prefetch"_svh: // ms
+        prefetch_ = std::max(stoll(val), 0LL);
+        return;
+    case "depth"_svh: // frames in flight. 1: low latency for scrubbing. auto or N > 1: throughput for playback/export
+        if (val == "auto")
+            depth_ = std::clamp(thread::hardware_concurrency() / 4, 2u, 8u);
+        else
+            depth_ = std::clamp(stoi(val), 1, 32); // jobs of a frame * depth_ are tracked to abort
+        return;
     case "gpu"_svh:
     case "pipeline"_svh: {
         if ("auto"sv == val) { // metal > cuda > opencl > cpu
@@ -893,13 +2794,75 @@ void BRawReader::onPropertyChanged(const std::string& key, const std::string& va
     case "copy"_svh:
         copy_ = stoi(val);
         return;
+    case "audio"_svh: // 0: no audio frames
+        audioEnabled_ = stoi(val) != 0;
+        return;
+    case "audio.format"_svh: // f32: float, f32p: planar float. otherwise the pcm format of clip
+        audioOpt_.toFloat = val == "f32" || val == "f32p";
+        audioOpt_.planar = val == "f32p";
+        return;
+    case "audio.chunk"_svh: // samples per channel of an audio frame
+        audioOpt_.chunk = std::max(stoi(val), 64);
+        return;
+    case "audio.ahead"_svh: // audio frames read ahead
+        audioOpt_.ahead = std::max(stoi(val), 1);
+        return;
+    case "waveform"_svh: // 1: min/max/rms overview of audio in background, file path is property "waveform.file" and event "audio.waveform"
+        waveform_ = stoi(val) != 0;
+        if (waveform_ && clip_)
+            startWaveform();
+        return;
+    case "waveform.dir"_svh: // cache dir of overview files. default is temp dir
+        waveformDir_ = val;
+        return;
+    case "video.tracks"_svh: { // comma separated video tracks of multi-track clip, decoded concurrently and packed into 1 frame. gpu frames can not be packed, only the first track is delivered
+        tracksOpt_.clear();
+        for (const char* p = val.data(); *p;) {
+            char* e = nullptr;
+            tracksOpt_.push_back(strtoul(p, &e, 10));
+            if (e == p)
+                break;
+            p = *e == ',' ? e + 1 : e;
+        }
+    }
+        return;
+    case "immersive"_svh: // immersive clip: sbs: left and right eyes side by side, tb: top-bottom. otherwise the default track only. gpu frames: the left eye only
+        if (val == "sbs" || val == "tb")
+            stereo_ = val == "tb";
+        else
+            stereo_.reset();
+        return;
+    case "video.tracks.layout"_svh: // hstack(default): side by side, vstack: top to bottom
+        tracksVertical_ = val == "vstack";
+        return;
+    case "display.fps"_svh: // display refresh rate to skip frames can not be shown in fast playback. 0: clip frame rate
+        displayFps_ = std::max(stof(val), 0.0f);
+        return;
+    case "fast.rate"_svh: // playback rate from which frames are decoded at 1/4 scale. 0: disabled
+        fastRate_ = std::max(stof(val), 0.0f);
+        return;
+    case "deadline"_svh: // ms a frame can be late before dropped without decoding. < 0: disabled
+        deadline_ = stoll(val);
+        return;
+    case "adaptive"_svh: // 1: lower resolution scale while decoding is slower than real time, restore when there is headroom
+        adaptive_ = stoi(val) != 0;
+        if (!adaptive_)
+            adaptiveScale_ = 0;
+        return;
+    case "resize"_svh: // exact output size of "size" option: bilinear, lanczos. otherwise the closest scale
+        if (val == "bilinear")
+            resize_ = convert::Filter::Bilinear;
+        else if (val == "lanczos")
+            resize_ = convert::Filter::Lanczos;
+        else
+            resize_.reset();
+        return;
     case "scale"_svh:
-    case "size"_svh: { // widthxheight or width(height=width)
+    case "size"_svh: { // widthxheight, width(height=width), widthx or xheight. the empty dimension of widthx and xheight follows the aspect ratio
         if (val.contains('x')) { // closest scale to target resolution
             char* s = nullptr;
             scaleToW_ = strtoul(val.data(), &s, 10);
-            if (s && s[0] == 'x')
-                scaleToH_ = strtoul(s + 1, nullptr, 10);
+            scaleToH_ = s && s[0] == 'x' ? strtoul(s + 1, nullptr, 10) : 0;
         } else if (val.starts_with("1/")) {
             const auto s = atoi(&val[2]);
             if (s >= 6) {
@@ -922,7 +2885,9 @@ void BRawReader::onPropertyChanged(const std::string& key, const std::string& va
         parse(val.data());
         return;
     }
-    // TODO: if property is a clip attribute and exists, guess VARIANT then SetClipAttribute(). if not exist, insert only
+    // clip and frame processing attributes, key is FOURCC, e.g. expo, wbkv, gama. the current frame is processed again if paused and the value is changed
+    if (!publishing_ && setAttribute(key, val))
+        regrade();
 }
 
 MDK_NS_END
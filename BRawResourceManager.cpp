@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#include "BRawResourceManager.h"
+#include <bit>
+#include <cstring>
+#include <new>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+using namespace std;
+
+static constexpr size_t kHugePage = 2 << 20;
+static constexpr align_val_t kAlign{64};
+
+static size_t size_class(size_t size)
+{
+    if (size <= 4096)
+        return 4096;
+    const size_t step = bit_floor(size) / 8; // 8 classes per power of 2, at most 12.5% larger
+    return (size + step - 1) / step * step;
+}
+
+BRawResourceManager::BRawResourceManager(IBlackmagicRawResourceManager* fallback)
+    : fallback_(fallback)
+{
+}
+
+BRawResourceManager::~BRawResourceManager()
+{
+    for (const auto& [size, b] : free_)
+        deallocate(b.first, b.second);
+    for (const auto& [p, b] : live_) {
+        if (b.cpu)
+            deallocate(p, b);
+    }
+}
+
+void BRawResourceManager::setCacheLimit(size_t bytes)
+{
+    vector<pair<void*, Block>> evicted;
+    {
+        const scoped_lock lock(mtx_);
+        limit_ = bytes;
+        while (cached_ > limit_ && !free_.empty()) {
+            const auto it = prev(free_.end()); // free larger blocks first
+            cached_ -= it->first;
+            evicted.push_back(it->second);
+            free_.erase(it);
+        }
+    }
+    for (const auto& [p, b] : evicted)
+        deallocate(p, b);
+}
+
+uint64_t BRawResourceManager::bytes(BlackmagicRawResourceUsage usage) const
+{
+    const scoped_lock lock(mtx_);
+    const auto it = bytes_.find(usage);
+    return it == bytes_.cend() ? 0 : it->second;
+}
+
+uint64_t BRawResourceManager::cachedBytes() const
+{
+    const scoped_lock lock(mtx_);
+    return cached_;
+}
+
+void BRawResourceManager::clear()
+{
+    size_t limit = 0;
+    {
+        const scoped_lock lock(mtx_);
+        limit = limit_;
+    }
+    setCacheLimit(0);
+    const scoped_lock lock(mtx_);
+    limit_ = limit;
+}
+
+HRESULT BRawResourceManager::CreateResource(void* context, void* commandQueue, uint32_t sizeBytes, BlackmagicRawResourceType type, BlackmagicRawResourceUsage usage, void** resource)
+{
+    if (!resource)
+        return E_POINTER;
+    if (type != blackmagicRawResourceTypeBufferCPU) {
+        if (!fallback_)
+            return E_NOTIMPL;
+        const auto hr = fallback_->CreateResource(context, commandQueue, sizeBytes, type, usage, resource);
+        if (SUCCEEDED(hr)) {
+            const scoped_lock lock(mtx_);
+            live_[*resource] = {sizeBytes, usage, false, false};
+            bytes_[usage] += sizeBytes;
+        }
+        return hr;
+    }
+    const auto size = size_class(sizeBytes);
+    {
+        const scoped_lock lock(mtx_);
+        if (const auto it = free_.find(size); it != free_.end()) {
+            auto [p, b] = it->second;
+            b.usage = usage;
+            cached_ -= size;
+            free_.erase(it);
+            live_[p] = b;
+            bytes_[usage] += size;
+            *resource = p;
+            return S_OK;
+        }
+    }
+    bool mapped = false;
+    const auto p = allocate(size, &mapped);
+    if (!p)
+        return E_OUTOFMEMORY;
+    const scoped_lock lock(mtx_);
+    live_[p] = {size, usage, true, mapped};
+    bytes_[usage] += size;
+    *resource = p;
+    return S_OK;
+}
+
+HRESULT BRawResourceManager::ReleaseResource(void* context, void* commandQueue, void* resource, BlackmagicRawResourceType type)
+{
+    vector<pair<void*, Block>> evicted;
+    {
+        const scoped_lock lock(mtx_);
+        const auto it = live_.find(resource);
+        if (it == live_.end()) // not created by this manager
+            return fallback_ ? fallback_->ReleaseResource(context, commandQueue, resource, type) : E_INVALIDARG;
+        const auto b = it->second;
+        live_.erase(it);
+        bytes_[b.usage] -= b.size;
+        if (b.cpu) {
+            if (b.size > limit_) {
+                evicted.emplace_back(resource, b);
+            } else {
+                free_.emplace(b.size, pair{resource, b});
+                cached_ += b.size;
+                while (cached_ > limit_) { // least likely reused: the smallest
+                    const auto victim = free_.begin();
+                    cached_ -= victim->first;
+                    evicted.push_back(victim->second);
+                    free_.erase(victim);
+                }
+            }
+        }
+    }
+    if (type != blackmagicRawResourceTypeBufferCPU)
+        return fallback_->ReleaseResource(context, commandQueue, resource, type);
+    for (const auto& [p, b] : evicted)
+        deallocate(p, b);
+    return S_OK;
+}
+
+HRESULT BRawResourceManager::CopyResource(void* context, void* commandQueue, void* source, BlackmagicRawResourceType sourceType, void* destination, BlackmagicRawResourceType destinationType, uint32_t sizeBytes, bool copyAsync)
+{
+    if (sourceType == blackmagicRawResourceTypeBufferCPU && destinationType == blackmagicRawResourceTypeBufferCPU) {
+        memcpy(destination, source, sizeBytes);
+        return S_OK;
+    }
+    if (!fallback_)
+        return E_NOTIMPL;
+    return fallback_->CopyResource(context, commandQueue, source, sourceType, destination, destinationType, sizeBytes, copyAsync);
+}
+
+HRESULT BRawResourceManager::GetResourceHostPointer(void* context, void* commandQueue, void* resource, BlackmagicRawResourceType resourceType, void** hostPointer)
+{
+    if (resourceType == blackmagicRawResourceTypeBufferCPU) {
+        *hostPointer = resource;
+        return S_OK;
+    }
+    if (!fallback_)
+        return E_NOTIMPL;
+    return fallback_->GetResourceHostPointer(context, commandQueue, resource, resourceType, hostPointer);
+}
+
+HRESULT BRawResourceManager::QueryInterface(REFIID iid, LPVOID* ppv)
+{
+    if (!ppv)
+        return E_POINTER;
+    const auto& unknown = IID_IUnknown;
+    if (memcmp(&iid, &unknown, sizeof(unknown)) == 0 || memcmp(&iid, &IID_IBlackmagicRawResourceManager, sizeof(unknown)) == 0) {
+        AddRef();
+        *ppv = static_cast<IBlackmagicRawResourceManager*>(this);
+        return S_OK;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+}
+
+ULONG BRawResourceManager::AddRef()
+{
+    return ++ref_;
+}
+
+ULONG BRawResourceManager::Release()
+{
+    const auto n = --ref_;
+    if (n == 0)
+        delete this;
+    return n;
+}
+
+void* BRawResourceManager::allocate(size_t size, bool* mapped)
+{
+    *mapped = false;
+    if (huge_ && size >= kHugePage) {
+#if defined(_WIN32)
+        if (const auto large = GetLargePageMinimum(); large > 0) { // requires SeLockMemoryPrivilege
+            if (auto p = VirtualAlloc(nullptr, (size + large - 1) / large * large, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE)) {
+                *mapped = true;
+                return p;
+            }
+        }
+#elif defined(__linux__)
+        if (auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0); p != MAP_FAILED) {
+            madvise(p, size, MADV_HUGEPAGE); // transparent huge pages
+            *mapped = true;
+            return p;
+        }
+#endif
+    }
+    return ::operator new(size, kAlign, nothrow);
+}
+
+void BRawResourceManager::deallocate(void* p, const Block& b)
+{
+    if (!b.mapped) {
+        ::operator delete(p, kAlign);
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, b.size);
+#endif
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include "BlackmagicRawAPI.h"
+#include "ComPtr.h"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// cpu resources are recycled by size class, others are forwarded to the sdk default manager. live bytes are counted per usage
+class BRawResourceManager final : public IBlackmagicRawResourceManager
+{
+public:
+    explicit BRawResourceManager(IBlackmagicRawResourceManager* fallback);
+    ~BRawResourceManager();
+
+    void setHugePages(bool value) { huge_ = value; } // for new cpu allocations >= 2MB
+    void setCacheLimit(size_t bytes); // max bytes of released cpu blocks kept for reuse
+    uint64_t bytes(BlackmagicRawResourceUsage usage) const; // live bytes
+    uint64_t cachedBytes() const;
+    void clear(); // free released cpu blocks
+
+    // IBlackmagicRawResourceManager
+    HRESULT CreateResource(void* context, void* commandQueue, uint32_t sizeBytes, BlackmagicRawResourceType type, BlackmagicRawResourceUsage usage, void** resource) override;
+    HRESULT ReleaseResource(void* context, void* commandQueue, void* resource, BlackmagicRawResourceType type) override;
+    HRESULT CopyResource(void* context, void* commandQueue, void* source, BlackmagicRawResourceType sourceType, void* destination, BlackmagicRawResourceType destinationType, uint32_t sizeBytes, bool copyAsync) override;
+    HRESULT GetResourceHostPointer(void* context, void* commandQueue, void* resource, BlackmagicRawResourceType resourceType, void** hostPointer) override;
+    // IUnknown
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID* ppv) override;
+    ULONG STDMETHODCALLTYPE AddRef() override;
+    ULONG STDMETHODCALLTYPE Release() override;
+private:
+    struct Block {
+        size_t size; // size class
+        BlackmagicRawResourceUsage usage;
+        bool cpu;
+        bool mapped; // huge pages
+    };
+    void* allocate(size_t size, bool* mapped);
+    void deallocate(void* p, const Block& b);
+    void trim(); // free cached blocks over limit_
+
+    std::atomic<ULONG> ref_ = 1;
+    Microsoft::WRL::ComPtr<IBlackmagicRawResourceManager> fallback_;
+    bool huge_ = false;
+    mutable std::mutex mtx_;
+    size_t limit_ = 512 << 20;
+    size_t cached_ = 0;
+    std::unordered_map<void*, Block> live_;
+    std::multimap<size_t, std::pair<void*, Block>> free_; // released cpu blocks by size class
+    std::unordered_map<BlackmagicRawResourceUsage, uint64_t> bytes_;
+};
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// cpu buffers reused by jobs. get() returns nullptr if all blocks are in use
+class BufferPool
+{
+public:
+    // blockSize: default size of get(). 0: variable size, e.g. decoded buffers depends on resolution scale
+    void reset(size_t blockSize, size_t maxBlocks) {
+        const std::scoped_lock lock(mtx_);
+        blocks_.clear();
+        blockSize_ = blockSize;
+        maxBlocks_ = maxBlocks;
+    }
+
+    uint8_t* get(size_t size = 0) {
+        if (size == 0)
+            size = blockSize_;
+        if (size == 0)
+            return nullptr;
+        const std::scoped_lock lock(mtx_);
+        Block* small = nullptr; // a free block to reallocate
+        for (auto& b : blocks_) {
+            if (b.used)
+                continue;
+            if (b.size >= size) {
+                b.used = true;
+                return b.data.get();
+            }
+            small = &b;
+        }
+        if (blocks_.size() < maxBlocks_) {
+            blocks_.push_back({std::unique_ptr<uint8_t[]>(new uint8_t[size]), size, true});
+            return blocks_.back().data.get();
+        }
+        if (!small)
+            return nullptr;
+        small->data.reset(new uint8_t[size]);
+        small->size = size;
+        small->used = true;
+        return small->data.get();
+    }
+
+    void put(uint8_t* p) {
+        if (!p)
+            return;
+        const std::scoped_lock lock(mtx_);
+        for (auto& b : blocks_) {
+            if (b.data.get() == p) {
+                b.used = false;
+                return;
+            }
+        }
+    }
+
+    size_t blockSize() const { return blockSize_; }
+
+    size_t bytes() const { // allocated
+        const std::scoped_lock lock(mtx_);
+        size_t n = 0;
+        for (const auto& b : blocks_)
+            n += b.size;
+        return n;
+    }
+private:
+    struct Block {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+        bool used;
+    };
+
+    mutable std::mutex mtx_;
+    size_t blockSize_ = 0;
+    size_t maxBlocks_ = 0;
+    std::vector<Block> blocks_;
+};
@@ -0,0 +1,726 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#include "Convert.h"
+#include "Isa.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <numbers>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace convert {
+namespace {
+
+// fixed point coefficients. luma: 15-bit rgb(input >> 1) * 2^15 scaled, result >> 14. chroma: 16-bit averaged rgb, result >> 15
+struct Coefs {
+    int16_t yr, yg, yb;
+    int32_t yoff;
+    int32_t ur, ug, ub;
+    int32_t vr, vg, vb;
+};
+
+Coefs make_coefs(Matrix matrix, bool fullRange)
+{
+    double kr = 0.2126, kb = 0.0722;
+    if (matrix == Matrix::BT601) {
+        kr = 0.299;
+        kb = 0.114;
+    } else if (matrix == Matrix::BT2020) {
+        kr = 0.2627;
+        kb = 0.0593;
+    }
+    const double kg = 1.0 - kr - kb;
+    const double ys = (fullRange ? 65535.0 : 219.0 * 256.0) / 65535.0; // 16-bit output range / input range
+    const double cs = (fullRange ? 65535.0 : 224.0 * 256.0) / 65535.0;
+    const auto q = [](double v) { return (int32_t)(v * 32768.0 + (v < 0 ? -0.5 : 0.5)); };
+    Coefs c{};
+    c.yr = (int16_t)q(kr * ys);
+    c.yg = (int16_t)q(kg * ys);
+    c.yb = (int16_t)q(kb * ys);
+    c.yoff = fullRange ? 0 : 16 * 256;
+    c.ur = q(-kr / (2.0 * (1.0 - kb)) * cs);
+    c.ug = q(-kg / (2.0 * (1.0 - kb)) * cs);
+    c.ub = q(0.5 * cs);
+    c.vr = q(0.5 * cs);
+    c.vg = q(-kg / (2.0 * (1.0 - kr)) * cs);
+    c.vb = q(-kb / (2.0 * (1.0 - kr)) * cs);
+    return c;
+}
+
+inline uint16_t clamp16(int32_t v)
+{
+    return (uint16_t)std::clamp<int32_t>(v, 0, 65535);
+}
+
+inline uint16_t luma(const uint16_t* p, const Coefs& c)
+{
+    const int32_t s = (p[0] >> 1) * c.yr + (p[1] >> 1) * c.yg + (p[2] >> 1) * c.yb;
+    return clamp16(((s + (1 << 13)) >> 14) + c.yoff);
+}
+
+inline void chroma(int32_t r, int32_t g, int32_t b, const Coefs& c, uint16_t* u, uint16_t* v)
+{
+    *u = clamp16(((r * c.ur + g * c.ug + b * c.ub + (1 << 14)) >> 15) + 32768);
+    *v = clamp16(((r * c.vr + g * c.vg + b * c.vb + (1 << 14)) >> 15) + 32768);
+}
+
+// 16-bit y of w pixels
+void y_row_c(const uint16_t* s, int w, uint16_t* y, const Coefs& c, int x = 0)
+{
+    for (; x < w; ++x)
+        y[x] = luma(s + 4 * x, c);
+}
+
+// (w + 1) / 2 chroma samples. s1: the next row for 4:2:0, null for 4:2:2. odd width: the last pixel is repeated
+void uv_row_c(const uint16_t* s0, const uint16_t* s1, int w, uint16_t* u, uint16_t* v, const Coefs& c, int i = 0)
+{
+    for (; i < (w + 1) / 2; ++i) {
+        const int x0 = 2 * i;
+        const int x1 = std::min(x0 + 1, w - 1);
+        int32_t rgb[3];
+        for (int k = 0; k < 3; ++k) {
+            if (s1)
+                rgb[k] = (s0[4 * x0 + k] + s0[4 * x1 + k] + s1[4 * x0 + k] + s1[4 * x1 + k] + 2) >> 2;
+            else
+                rgb[k] = (s0[4 * x0 + k] + s0[4 * x1 + k] + 1) >> 1;
+        }
+        chroma(rgb[0], rgb[1], rgb[2], c, &u[i], &v[i]);
+    }
+}
+
+// resize 4 channel 8 or 16-bit pixels of a row horizontally to 16-bit. coef: n per output pixel, sum is 1 << 14
+void h_row_c(const uint8_t* src, int bpc, int w, const int* start, const int16_t* coef, int n, uint16_t* dst)
+{
+    const int shift = bpc == 2 ? 14 : 6; // 8-bit: v << 8
+    for (int x = 0; x < w; ++x) {
+        int32_t acc[4]{};
+        const int16_t* k = coef + x * n;
+        for (int j = 0; j < n; ++j) {
+            const int s = 4 * (start[x] + j);
+            for (int c = 0; c < 4; ++c)
+                acc[c] += (bpc == 2 ? ((const uint16_t*)src)[s + c] : src[s + c]) * k[j];
+        }
+        for (int c = 0; c < 4; ++c)
+            dst[4 * x + c] = clamp16((acc[c] + (1 << (shift - 1))) >> shift);
+    }
+}
+
+// vertical resize of n rows of count 16-bit values
+void v_row_c(const uint16_t* const* rows, const int16_t* coef, int n, int count, uint16_t* dst, int i = 0)
+{
+    for (; i < count; ++i) {
+        int32_t acc = 0;
+        for (int j = 0; j < n; ++j)
+            acc += rows[j][i] * coef[j];
+        dst[i] = clamp16((acc + (1 << 13)) >> 14);
+    }
+}
+
+#if ISA_X86
+ISA_TARGET("sse4.1")
+void y_row_sse41(const uint16_t* s, int w, uint16_t* y, const Coefs& c)
+{
+    const __m128i k = _mm_setr_epi16(c.yr, c.yg, c.yb, 0, c.yr, c.yg, c.yb, 0);
+    const __m128i rnd = _mm_set1_epi32(1 << 13);
+    const __m128i off = _mm_set1_epi32(c.yoff);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        const __m128i* p = (const __m128i*)(s + 4 * x); // 2 pixels per register
+        const __m128i m0 = _mm_madd_epi16(_mm_srli_epi16(_mm_loadu_si128(p + 0), 1), k);
+        const __m128i m1 = _mm_madd_epi16(_mm_srli_epi16(_mm_loadu_si128(p + 1), 1), k);
+        const __m128i m2 = _mm_madd_epi16(_mm_srli_epi16(_mm_loadu_si128(p + 2), 1), k);
+        const __m128i m3 = _mm_madd_epi16(_mm_srli_epi16(_mm_loadu_si128(p + 3), 1), k);
+        __m128i y0 = _mm_hadd_epi32(m0, m1);
+        __m128i y1 = _mm_hadd_epi32(m2, m3);
+        y0 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(y0, rnd), 14), off);
+        y1 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(y1, rnd), 14), off);
+        _mm_storeu_si128((__m128i*)(y + x), _mm_packus_epi32(y0, y1));
+    }
+    y_row_c(s, w, y, c, x);
+}
+
+ISA_TARGET("sse4.1")
+inline __m128i avg_px_sse41(const uint16_t* s0, const uint16_t* s1, int x0, int x1)
+{ // rgba of a chroma sample in 32-bit
+    const __m128i rnd1 = _mm_set1_epi32(1);
+    __m128i sum = _mm_add_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(s0 + 4 * x0))), _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(s0 + 4 * x1))));
+    if (!s1)
+        return _mm_srli_epi32(_mm_add_epi32(sum, rnd1), 1);
+    sum = _mm_add_epi32(sum, _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(s1 + 4 * x0))));
+    sum = _mm_add_epi32(sum, _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(s1 + 4 * x1))));
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+}
+
+ISA_TARGET("sse4.1")
+inline __m128i dot4_sse41(const __m128i px[4], __m128i k)
+{ // rgb dot k of 4 pixels
+    return _mm_hadd_epi32(_mm_hadd_epi32(_mm_mullo_epi32(px[0], k), _mm_mullo_epi32(px[1], k)),
+                          _mm_hadd_epi32(_mm_mullo_epi32(px[2], k), _mm_mullo_epi32(px[3], k)));
+}
+
+ISA_TARGET("sse4.1")
+void uv_row_sse41(const uint16_t* s0, const uint16_t* s1, int w, uint16_t* u, uint16_t* v, const Coefs& c)
+{
+    const __m128i ku = _mm_setr_epi32(c.ur, c.ug, c.ub, 0);
+    const __m128i kv = _mm_setr_epi32(c.vr, c.vg, c.vb, 0);
+    const __m128i rnd = _mm_set1_epi32(1 << 14);
+    const __m128i off = _mm_set1_epi32(32768);
+    int i = 0;
+    for (; 2 * i + 8 <= w; i += 4) {
+        __m128i px[4];
+        for (int j = 0; j < 4; ++j)
+            px[j] = avg_px_sse41(s0, s1, 2 * (i + j), 2 * (i + j) + 1);
+        const __m128i uv = _mm_packus_epi32(_mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(dot4_sse41(px, ku), rnd), 15), off),
+                                            _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(dot4_sse41(px, kv), rnd), 15), off));
+        _mm_storel_epi64((__m128i*)(u + i), uv);
+        _mm_storel_epi64((__m128i*)(v + i), _mm_srli_si128(uv, 8));
+    }
+    uv_row_c(s0, s1, w, u, v, c, i);
+}
+
+ISA_TARGET("avx2")
+void y_row_avx2(const uint16_t* s, int w, uint16_t* y, const Coefs& c)
+{
+    const __m256i k = _mm256_setr_epi16(c.yr, c.yg, c.yb, 0, c.yr, c.yg, c.yb, 0, c.yr, c.yg, c.yb, 0, c.yr, c.yg, c.yb, 0);
+    const __m256i rnd = _mm256_set1_epi32(1 << 13);
+    const __m256i off = _mm256_set1_epi32(c.yoff);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        const __m256i* p = (const __m256i*)(s + 4 * x); // 4 pixels per register
+        __m256i m[4];
+        for (int j = 0; j < 4; ++j)
+            m[j] = _mm256_madd_epi16(_mm256_srli_epi16(_mm256_loadu_si256(p + j), 1), k);
+        // hadd in lanes: y0-1,4-5 | y2-3,6-7 => y0-3 | y4-7
+        __m256i y0 = _mm256_permute4x64_epi64(_mm256_hadd_epi32(m[0], m[1]), 0xd8);
+        __m256i y1 = _mm256_permute4x64_epi64(_mm256_hadd_epi32(m[2], m[3]), 0xd8);
+        y0 = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(y0, rnd), 14), off);
+        y1 = _mm256_add_epi32(_mm256_srai_epi32(_mm256_add_epi32(y1, rnd), 14), off);
+        _mm256_storeu_si256((__m256i*)(y + x), _mm256_permute4x64_epi64(_mm256_packus_epi32(y0, y1), 0xd8));
+    }
+    y_row_sse41(s + 4 * x, w - x, y + x, c);
+}
+
+ISA_TARGET("sse4.1")
+void h_row_sse41(const uint8_t* src, int bpc, int w, const int* start, const int16_t* coef, int n, uint16_t* dst)
+{ // 4 channels of a pixel in a register
+    const int shift = bpc == 2 ? 14 : 6;
+    const __m128i rnd = _mm_set1_epi32(1 << (shift - 1));
+    const __m128i sh = _mm_cvtsi32_si128(shift);
+    for (int x = 0; x < w; ++x) {
+        __m128i acc = _mm_setzero_si128();
+        const int16_t* k = coef + x * n;
+        const uint8_t* s = src + 4 * bpc * start[x];
+        for (int j = 0; j < n; ++j, s += 4 * bpc) {
+            __m128i px;
+            if (bpc == 2) {
+                px = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)s));
+            } else {
+                int32_t v;
+                memcpy(&v, s, sizeof(v));
+                px = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+            }
+            acc = _mm_add_epi32(acc, _mm_mullo_epi32(px, _mm_set1_epi32(k[j])));
+        }
+        acc = _mm_sra_epi32(_mm_add_epi32(acc, rnd), sh);
+        _mm_storel_epi64((__m128i*)(dst + 4 * x), _mm_packus_epi32(acc, acc));
+    }
+}
+
+ISA_TARGET("sse4.1")
+void v_row_sse41(const uint16_t* const* rows, const int16_t* coef, int n, int count, uint16_t* dst, int i)
+{
+    const __m128i rnd = _mm_set1_epi32(1 << 13);
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = rnd, hi = rnd;
+        for (int j = 0; j < n; ++j) {
+            const __m128i px = _mm_loadu_si128((const __m128i*)(rows[j] + i));
+            const __m128i k = _mm_set1_epi32(coef[j]);
+            lo = _mm_add_epi32(lo, _mm_mullo_epi32(_mm_cvtepu16_epi32(px), k));
+            hi = _mm_add_epi32(hi, _mm_mullo_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(px, 8)), k));
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi32(_mm_srai_epi32(lo, 14), _mm_srai_epi32(hi, 14)));
+    }
+    v_row_c(rows, coef, n, count, dst, i);
+}
+
+ISA_TARGET("avx2")
+void v_row_avx2(const uint16_t* const* rows, const int16_t* coef, int n, int count, uint16_t* dst, int i)
+{
+    const __m256i rnd = _mm256_set1_epi32(1 << 13);
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = rnd, hi = rnd;
+        for (int j = 0; j < n; ++j) {
+            const __m128i* p = (const __m128i*)(rows[j] + i);
+            const __m256i k = _mm256_set1_epi32(coef[j]);
+            lo = _mm256_add_epi32(lo, _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(p)), k));
+            hi = _mm256_add_epi32(hi, _mm256_mullo_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(p + 1)), k));
+        }
+        const __m256i v = _mm256_packus_epi32(_mm256_srai_epi32(lo, 14), _mm256_srai_epi32(hi, 14)); // in lane
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(v, 0xd8));
+    }
+    v_row_sse41(rows, coef, n, count, dst, i);
+}
+#endif // ISA_X86
+
+#if ISA_NEON
+void y_row_neon(const uint16_t* s, int w, uint16_t* y, const Coefs& c)
+{
+    const uint32x4_t rnd = vdupq_n_u32(1 << 13);
+    const uint32x4_t off = vdupq_n_u32((uint32_t)c.yoff);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        const uint16x8x4_t p = vld4q_u16(s + 4 * x);
+        const uint16x8_t r = vshrq_n_u16(p.val[0], 1);
+        const uint16x8_t g = vshrq_n_u16(p.val[1], 1);
+        const uint16x8_t b = vshrq_n_u16(p.val[2], 1);
+        uint32x4_t lo = vmull_n_u16(vget_low_u16(r), (uint16_t)c.yr);
+        uint32x4_t hi = vmull_n_u16(vget_high_u16(r), (uint16_t)c.yr);
+        lo = vmlal_n_u16(lo, vget_low_u16(g), (uint16_t)c.yg);
+        hi = vmlal_n_u16(hi, vget_high_u16(g), (uint16_t)c.yg);
+        lo = vmlal_n_u16(lo, vget_low_u16(b), (uint16_t)c.yb);
+        hi = vmlal_n_u16(hi, vget_high_u16(b), (uint16_t)c.yb);
+        lo = vaddq_u32(vshrq_n_u32(vaddq_u32(lo, rnd), 14), off);
+        hi = vaddq_u32(vshrq_n_u32(vaddq_u32(hi, rnd), 14), off);
+        vst1q_u16(y + x, vcombine_u16(vqmovn_u32(lo), vqmovn_u32(hi)));
+    }
+    y_row_c(s, w, y, c, x);
+}
+
+void uv_row_neon(const uint16_t* s0, const uint16_t* s1, int w, uint16_t* u, uint16_t* v, const Coefs& c)
+{
+    const int32x4_t rnd = vdupq_n_s32(1 << 14);
+    const int32x4_t off = vdupq_n_s32(32768);
+    int i = 0;
+    for (; 2 * i + 8 <= w; i += 4) {
+        const uint16x8x4_t p0 = vld4q_u16(s0 + 8 * i);
+        int32x4_t rgb[3];
+        for (int k = 0; k < 3; ++k) {
+            uint32x4_t sum = vpaddlq_u16(p0.val[k]); // horizontal pairs
+            if (s1) {
+                sum = vpadalq_u16(sum, vld4q_u16(s1 + 8 * i).val[k]);
+                sum = vshrq_n_u32(vaddq_u32(sum, vdupq_n_u32(2)), 2);
+            } else {
+                sum = vshrq_n_u32(vaddq_u32(sum, vdupq_n_u32(1)), 1);
+            }
+            rgb[k] = vreinterpretq_s32_u32(sum);
+        }
+        int32x4_t du = vmulq_n_s32(rgb[0], c.ur);
+        du = vmlaq_n_s32(du, rgb[1], c.ug);
+        du = vmlaq_n_s32(du, rgb[2], c.ub);
+        int32x4_t dv = vmulq_n_s32(rgb[0], c.vr);
+        dv = vmlaq_n_s32(dv, rgb[1], c.vg);
+        dv = vmlaq_n_s32(dv, rgb[2], c.vb);
+        du = vaddq_s32(vshrq_n_s32(vaddq_s32(du, rnd), 15), off);
+        dv = vaddq_s32(vshrq_n_s32(vaddq_s32(dv, rnd), 15), off);
+        vst1_u16(u + i, vqmovun_s32(du));
+        vst1_u16(v + i, vqmovun_s32(dv));
+    }
+    uv_row_c(s0, s1, w, u, v, c, i);
+}
+
+void h_row_neon(const uint8_t* src, int bpc, int w, const int* start, const int16_t* coef, int n, uint16_t* dst)
+{
+    const int32x4_t rnd = vdupq_n_s32(1 << ((bpc == 2 ? 14 : 6) - 1));
+    const int32x4_t sh = vdupq_n_s32(bpc == 2 ? -14 : -6); // shift right
+    for (int x = 0; x < w; ++x) {
+        int32x4_t acc = rnd;
+        const int16_t* k = coef + x * n;
+        const uint8_t* s = src + 4 * bpc * start[x];
+        for (int j = 0; j < n; ++j, s += 4 * bpc) {
+            uint16x4_t px;
+            if (bpc == 2) {
+                px = vld1_u16((const uint16_t*)s);
+            } else {
+                uint32_t v;
+                memcpy(&v, s, sizeof(v));
+                px = vget_low_u16(vmovl_u8(vcreate_u8(v)));
+            }
+            acc = vmlaq_n_s32(acc, vreinterpretq_s32_u32(vmovl_u16(px)), k[j]);
+        }
+        vst1_u16(dst + 4 * x, vqmovun_s32(vshlq_s32(acc, sh)));
+    }
+}
+
+void v_row_neon(const uint16_t* const* rows, const int16_t* coef, int n, int count, uint16_t* dst, int i)
+{
+    for (; i + 8 <= count; i += 8) {
+        int32x4_t lo = vdupq_n_s32(1 << 13);
+        int32x4_t hi = lo;
+        for (int j = 0; j < n; ++j) {
+            const uint16x8_t px = vld1q_u16(rows[j] + i);
+            lo = vmlaq_n_s32(lo, vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(px))), coef[j]);
+            hi = vmlaq_n_s32(hi, vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(px))), coef[j]);
+        }
+        vst1q_u16(dst + i, vcombine_u16(vqmovun_s32(vshrq_n_s32(lo, 14)), vqmovun_s32(vshrq_n_s32(hi, 14))));
+    }
+    v_row_c(rows, coef, n, count, dst, i);
+}
+#endif // ISA_NEON
+
+using YRow = void(*)(const uint16_t*, int, uint16_t*, const Coefs&);
+using UVRow = void(*)(const uint16_t*, const uint16_t*, int, uint16_t*, uint16_t*, const Coefs&);
+using HRow = void(*)(const uint8_t*, int, int, const int*, const int16_t*, int, uint16_t*);
+using VRow = void(*)(const uint16_t* const*, const int16_t*, int, int, uint16_t*, int);
+
+void y_row_scalar(const uint16_t* s, int w, uint16_t* y, const Coefs& c) { y_row_c(s, w, y, c); }
+void uv_row_scalar(const uint16_t* s0, const uint16_t* s1, int w, uint16_t* u, uint16_t* v, const Coefs& c) { uv_row_c(s0, s1, w, u, v, c); }
+
+struct Kernels {
+    const char* name;
+    YRow y;
+    UVRow uv;
+    HRow h;
+    VRow v;
+};
+
+Kernels select(const char* force)
+{
+    [[maybe_unused]] const auto& cpu = isa::cpu();
+#if ISA_X86
+    if (cpu.avx2 && isa::allowed(force, "avx2"))
+        return {"avx2", y_row_avx2, uv_row_sse41, h_row_sse41, v_row_avx2}; // chroma is at most half of the work, h taps differ per pixel
+    if (cpu.sse41 && isa::allowed(force, "sse4.1"))
+        return {"sse4.1", y_row_sse41, uv_row_sse41, h_row_sse41, v_row_sse41};
+#elif ISA_NEON
+    if (cpu.neon && isa::allowed(force, "neon"))
+        return {"neon", y_row_neon, uv_row_neon, h_row_neon, v_row_neon};
+#endif
+    return {"c", y_row_scalar, uv_row_scalar, h_row_c, v_row_c};
+}
+
+Kernels& kernels()
+{
+    static Kernels k = select(nullptr);
+    return k;
+}
+
+inline uint16_t to10(uint16_t v)
+{
+    return (uint16_t)std::min((v + 32) >> 6, 1023);
+}
+
+inline uint8_t to8(uint16_t v)
+{
+    return (uint8_t)std::min((v + 128) >> 8, 255);
+}
+
+// rows [y0, y1) of dst, src is row y0. y0 is even for 4:2:0
+void convert_rows(const uint8_t* src, size_t srcStride, int w, int y0, int y1, Target target, const Coefs& c, uint8_t* const dst[3], const size_t dstStride[3])
+{
+    const auto& k = kernels();
+    const auto row = [&](int y) { return (const uint16_t*)(src + (y - y0) * srcStride); };
+    if (target == Target::X2RGB10) {
+        for (int y = y0; y < y1; ++y) {
+            const uint16_t* s = row(y);
+            auto d = (uint32_t*)(dst[0] + y * dstStride[0]);
+            for (int x = 0; x < w; ++x) // auto vectorized
+                d[x] = 0xc0000000u | (uint32_t(to10(s[4 * x])) << 20) | (uint32_t(to10(s[4 * x + 1])) << 10) | to10(s[4 * x + 2]);
+        }
+        return;
+    }
+    const int cw = (w + 1) / 2;
+    vector<uint16_t> tmp(w + 2 * cw);
+    uint16_t* yt = tmp.data();
+    uint16_t* ut = yt + w;
+    uint16_t* vt = ut + cw;
+    const auto storeY = [&](int y) {
+        k.y(row(y), w, yt, c);
+        switch (target) {
+        case Target::NV12: {
+            auto d = dst[0] + y * dstStride[0];
+            for (int x = 0; x < w; ++x)
+                d[x] = to8(yt[x]);
+        }
+            break;
+        case Target::P010: {
+            auto d = (uint16_t*)(dst[0] + y * dstStride[0]);
+            for (int x = 0; x < w; ++x)
+                d[x] = to10(yt[x]) << 6;
+        }
+            break;
+        default: {
+            auto d = (uint16_t*)(dst[0] + y * dstStride[0]);
+            for (int x = 0; x < w; ++x)
+                d[x] = to10(yt[x]);
+        }
+            break;
+        }
+    };
+    if (target == Target::YUV422P10) {
+        for (int y = y0; y < y1; ++y) {
+            storeY(y);
+            k.uv(row(y), nullptr, w, ut, vt, c);
+            auto du = (uint16_t*)(dst[1] + y * dstStride[1]);
+            auto dv = (uint16_t*)(dst[2] + y * dstStride[2]);
+            for (int i = 0; i < cw; ++i) {
+                du[i] = to10(ut[i]);
+                dv[i] = to10(vt[i]);
+            }
+        }
+        return;
+    }
+    const int h = y1;
+    for (int y = y0; y < y1; y += 2) {
+        const int yn = std::min(y + 1, h - 1); // odd height: the last row is repeated
+        storeY(y);
+        if (yn != y)
+            storeY(yn);
+        k.uv(row(y), row(yn), w, ut, vt, c);
+        if (target == Target::NV12) {
+            auto d = dst[1] + y / 2 * dstStride[1];
+            for (int i = 0; i < cw; ++i) {
+                d[2 * i] = to8(ut[i]);
+                d[2 * i + 1] = to8(vt[i]);
+            }
+        } else {
+            auto d = (uint16_t*)(dst[1] + y / 2 * dstStride[1]);
+            for (int i = 0; i < cw; ++i) {
+                d[2 * i] = to10(ut[i]) << 6;
+                d[2 * i + 1] = to10(vt[i]) << 6;
+            }
+        }
+    }
+}
+
+struct Taps {
+    int n = 0; // taps per output
+    vector<int> start; // first input of each output
+    vector<int16_t> coef; // n per output, sum is 1 << 14
+};
+
+double weight(Filter filter, double x)
+{
+    x = std::abs(x);
+    if (filter == Filter::Bilinear)
+        return std::max(1.0 - x, 0.0);
+    if (x < 1e-8)
+        return 1.0;
+    if (x >= 3.0)
+        return 0.0;
+    const double px = numbers::pi * x;
+    return 3.0 * sin(px) * sin(px / 3.0) / (px * px);
+}
+
+Taps make_taps(int src, int dst, Filter filter)
+{
+    const double scale = double(src) / dst;
+    const double fscale = std::max(scale, 1.0); // wider kernel to filter out high frequencies when downscaling
+    const double radius = (filter == Filter::Lanczos ? 3.0 : 1.0) * fscale;
+    const int m = (int)ceil(2 * radius) + 1;
+    Taps t;
+    t.n = std::min(m, src);
+    t.start.resize(dst);
+    t.coef.resize((size_t)dst * t.n);
+    vector<double> w(t.n);
+    for (int i = 0; i < dst; ++i) {
+        const double center = (i + 0.5) * scale - 0.5;
+        const int first = (int)floor(center - radius) + 1;
+        const int start = std::clamp(first, 0, src - t.n); // taps outside the image are folded to the edges
+        fill(w.begin(), w.end(), 0.0);
+        double sum = 0;
+        for (int j = 0; j < m; ++j) {
+            const double v = weight(filter, (first + j - center) / fscale);
+            w[std::clamp(first + j, 0, src - 1) - start] += v;
+            sum += v;
+        }
+        int16_t* c = &t.coef[(size_t)i * t.n];
+        int isum = 0;
+        int big = 0;
+        for (int j = 0; j < t.n; ++j) {
+            c[j] = (int16_t)lround(w[j] / sum * (1 << 14));
+            isum += c[j];
+            if (std::abs(w[j]) > std::abs(w[big]))
+                big = j;
+        }
+        c[big] += (1 << 14) - isum;
+        t.start[i] = start;
+    }
+    return t;
+}
+
+// output rows [y0, y1) of 16-bit rgba. to(y): where to write row y, written(y): after row y is written
+template<typename To, typename Written>
+void resize_rows(const uint8_t* src, size_t srcStride, int bpc, const Taps& h, const Taps& v, int width, int y0, int y1, To&& to, Written&& written)
+{
+    const auto& k = kernels();
+    const size_t n = 4 * (size_t)width;
+    vector<uint16_t> ring((size_t)v.n * n); // horizontally resized input rows, row r is in slot r % v.n
+    vector<const uint16_t*> rows(v.n);
+    int next = 0; // next input row to resize horizontally
+    for (int y = y0; y < y1; ++y) {
+        const int first = v.start[y];
+        for (next = std::max(next, first); next < first + v.n; ++next)
+            k.h(src + next * srcStride, bpc, width, h.start.data(), h.coef.data(), h.n, &ring[next % v.n * n]);
+        for (int j = 0; j < v.n; ++j)
+            rows[j] = &ring[(first + j) % v.n * n];
+        k.v(rows.data(), &v.coef[(size_t)y * v.n], v.n, (int)n, to(y), 0);
+        written(y);
+    }
+}
+
+// f(y0, y1) for bands of even rows
+template<typename F>
+void parallel(int height, Pool* pool, int minRows, F&& f)
+{
+    const int threads = std::clamp(pool ? pool->threads() : 1, 1, std::max(height / minRows, 1));
+    if (threads == 1) {
+        f(0, height);
+        return;
+    }
+    const int band = (height / threads + 1) & ~1; // even for 4:2:0
+    pool->run((height + band - 1) / band, [&](int i) {
+        f(i * band, std::min((i + 1) * band, height));
+    });
+}
+} // namespace
+
+struct Pool::Workers {
+    mutex running; // one run() at a time
+    mutex mtx;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int)>* f = nullptr;
+    int n = 0;
+    int next = 0; // next index to call
+    int busy = 0; // calls in progress
+    bool stop = false;
+    vector<thread> threads;
+
+    // called by workers and run(), returns after all indices are taken
+    void work(unique_lock<mutex>& lock) {
+        while (next < n) {
+            const int i = next++;
+            ++busy;
+            lock.unlock();
+            (*f)(i);
+            lock.lock();
+            if (--busy == 0 && next >= n)
+                done.notify_all();
+        }
+    }
+};
+
+Pool::Pool(int threads)
+    : threads_(std::max(threads, 1))
+    , w_(make_unique<Workers>())
+{
+    for (int i = 1; i < threads_; ++i) {
+        w_->threads.emplace_back([w = w_.get()]{
+            unique_lock lock(w->mtx);
+            while (true) {
+                w->wake.wait(lock, [w]{ return w->stop || w->next < w->n; });
+                if (w->stop)
+                    return;
+                w->work(lock);
+            }
+        });
+    }
+}
+
+Pool::~Pool()
+{
+    {
+        scoped_lock lock(w_->mtx);
+        w_->stop = true;
+    }
+    w_->wake.notify_all();
+    for (auto& t : w_->threads)
+        t.join();
+}
+
+void Pool::run(int n, const function<void(int)>& f)
+{
+    unique_lock running(w_->running, try_to_lock);
+    if (!running || w_->threads.empty()) { // frames converted by several threads at once are already parallel
+        for (int i = 0; i < n; ++i)
+            f(i);
+        return;
+    }
+    unique_lock lock(w_->mtx);
+    w_->f = &f;
+    w_->n = n;
+    w_->next = 0;
+    w_->wake.notify_all();
+    w_->work(lock);
+    w_->done.wait(lock, [this]{ return w_->busy == 0; });
+    w_->f = nullptr;
+    w_->n = w_->next = 0;
+}
+
+Layout layout(Target target, int width, int height)
+{
+    const size_t cw = (width + 1) / 2;
+    const size_t ch = (height + 1) / 2;
+    switch (target) {
+    case Target::NV12:
+        return {2, {(size_t)width, 2 * cw}, {(size_t)width * height, 2 * cw * ch}};
+    case Target::P010:
+        return {2, {2 * (size_t)width, 4 * cw}, {2 * (size_t)width * height, 4 * cw * ch}};
+    case Target::YUV422P10:
+        return {3, {2 * (size_t)width, 2 * cw, 2 * cw}, {2 * (size_t)width * height, 2 * cw * height, 2 * cw * height}};
+    case Target::X2RGB10:
+        return {1, {4 * (size_t)width}, {4 * (size_t)width * height}};
+    }
+    return {};
+}
+
+void rgba64(const uint8_t* src, size_t srcStride, int width, int height, Target target, Matrix matrix, bool fullRange, uint8_t* const dst[3], const size_t dstStride[3], Pool* pool)
+{
+    const auto c = make_coefs(matrix, fullRange);
+    parallel(height, pool, 64, [&](int y0, int y1) {
+        convert_rows(src + y0 * srcStride, srcStride, width, y0, y1, target, c, dst, dstStride);
+    });
+}
+
+void resize(const uint8_t* src, size_t srcStride, int srcWidth, int srcHeight, int bytesPerChannel, uint8_t* dst, size_t dstStride, int width, int height, Filter filter, Pool* pool)
+{
+    const auto h = make_taps(srcWidth, width, filter);
+    const auto v = make_taps(srcHeight, height, filter);
+    parallel(height, pool, 32, [&](int y0, int y1) {
+        if (bytesPerChannel == 2) {
+            resize_rows(src, srcStride, 2, h, v, width, y0, y1, [&](int y) { return (uint16_t*)(dst + y * dstStride); }, [](int) {});
+            return;
+        }
+        vector<uint16_t> line(4 * (size_t)width);
+        resize_rows(src, srcStride, 1, h, v, width, y0, y1, [&](int) { return line.data(); }, [&](int y) {
+            auto d = dst + y * dstStride;
+            for (size_t i = 0; i < line.size(); ++i)
+                d[i] = to8(line[i]);
+        });
+    });
+}
+
+void rgba64(const uint8_t* src, size_t srcStride, int srcWidth, int srcHeight, int width, int height, Filter filter, Target target, Matrix matrix, bool fullRange, uint8_t* const dst[3], const size_t dstStride[3], Pool* pool)
+{
+    const auto c = make_coefs(matrix, fullRange);
+    const auto h = make_taps(srcWidth, width, filter);
+    const auto v = make_taps(srcHeight, height, filter);
+    parallel(height, pool, 32, [&](int y0, int y1) {
+        constexpr int kRows = 16; // resized rows converted at once, in cache
+        const size_t stride = 8 * (size_t)width;
+        vector<uint8_t> chunk(kRows * stride);
+        int first = y0; // first row in chunk
+        resize_rows(src, srcStride, 2, h, v, width, y0, y1, [&](int y) { return (uint16_t*)&chunk[(y - first) * stride]; }, [&](int y) {
+            if (y + 1 - first < kRows && y + 1 < y1)
+                return;
+            convert_rows(chunk.data(), stride, width, first, y + 1, target, c, dst, dstStride);
+            first = y + 1;
+        });
+    });
+}
+
+const char* isa(const char* force)
+{
+    if (force)
+        kernels() = select(force);
+    return kernels().name;
+}
+
+} // namespace convert
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// convert rgba64le(blackmagicRawResourceFormatRGBAU16) to yuv or packed 10-bit rgb in 1 pass, optionally resized
+namespace convert {
+
+enum class Target {
+    NV12,
+    P010,       // 10 bits in msb
+    YUV422P10,  // 10 bits in lsb
+    X2RGB10,    // 32-bit little endian, b in lsb
+};
+
+enum class Matrix {
+    BT601,
+    BT709,
+    BT2020,
+};
+
+enum class Filter {
+    Bilinear,
+    Lanczos,    // 3 lobes
+};
+
+struct Layout {
+    int planes;
+    size_t stride[3];
+    size_t size[3];
+};
+
+// tightly packed planes of width x height
+Layout layout(Target target, int width, int height);
+
+// persistent threads converting row bands, created once instead of per frame
+class Pool
+{
+public:
+    explicit Pool(int threads); // including the caller of run()
+    ~Pool();
+    int threads() const { return threads_; }
+    // f(i) for i in [0, n) and wait. if another run() is in progress, all are called in the current thread
+    void run(int n, const std::function<void(int)>& f);
+private:
+    struct Workers;
+    int threads_;
+    std::unique_ptr<Workers> w_;
+};
+
+// pool: converts row bands in parallel, nullptr: current thread only
+void rgba64(const uint8_t* src, size_t srcStride, int width, int height, Target target, Matrix matrix, bool fullRange, uint8_t* const dst[3], const size_t dstStride[3], Pool* pool = nullptr);
+
+// resize 4 channel 8-bit(rgba, bgra) or 16-bit(rgba64le, bgra64le) image
+void resize(const uint8_t* src, size_t srcStride, int srcWidth, int srcHeight, int bytesPerChannel, uint8_t* dst, size_t dstStride, int width, int height, Filter filter, Pool* pool = nullptr);
+
+// resize rgba64le to width x height and convert to target, without a full size intermediate image
+void rgba64(const uint8_t* src, size_t srcStride, int srcWidth, int srcHeight, int width, int height, Filter filter, Target target, Matrix matrix, bool fullRange, uint8_t* const dst[3], const size_t dstStride[3], Pool* pool = nullptr);
+
+// selected kernels: "avx2", "sse4.1", "neon" or "c". force: use a kernel set for testing, nullptr for the best one
+const char* isa(const char* force = nullptr);
+
+} // namespace convert
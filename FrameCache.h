@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include "mdk/VideoFrame.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+MDK_NS_BEGIN
+
+// memory bounded LRU cache of processed frames
+class FrameCache
+{
+public:
+    struct Key {
+        uint64_t index;
+        uint32_t scale; // BlackmagicRawResolutionScale
+        PixelFormat format;
+        bool operator==(const Key&) const = default;
+    };
+
+    void setCapacity(size_t bytes) {
+        std::vector<VideoFrame> evicted;
+        {
+            const std::scoped_lock lock(mtx_);
+            capacity_ = bytes;
+            evict(evicted);
+        }
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    void put(const Key& key, const VideoFrame& frame, size_t bytes) {
+        if (bytes > capacity_)
+            return;
+        std::vector<VideoFrame> evicted; // destroy out of lock, frame release callback may wait
+        {
+            const std::scoped_lock lock(mtx_);
+            if (auto it = map_.find(key); it != map_.end()) {
+                bytes_ -= it->second->bytes;
+                evicted.push_back(std::move(it->second->frame));
+                lru_.erase(it->second);
+                map_.erase(it);
+            }
+            lru_.push_front({key, frame, bytes});
+            map_[key] = lru_.begin();
+            bytes_ += bytes;
+            evict(evicted);
+        }
+    }
+
+    bool get(const Key& key, VideoFrame& frame, size_t* bytes = nullptr) {
+        if (capacity_ == 0)
+            return false;
+        const std::scoped_lock lock(mtx_);
+        const auto it = map_.find(key);
+        if (it == map_.end()) {
+            misses_++;
+            return false;
+        }
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        frame = it->second->frame;
+        if (bytes)
+            *bytes = it->second->bytes;
+        return true;
+    }
+
+    void clear() {
+        std::list<Entry> entries;
+        {
+            const std::scoped_lock lock(mtx_);
+            map_.clear();
+            entries.swap(lru_);
+            bytes_ = 0;
+        }
+    }
+
+    size_t bytes() const {
+        const std::scoped_lock lock(mtx_);
+        return bytes_;
+    }
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+private:
+    struct Entry {
+        Key key;
+        VideoFrame frame;
+        size_t bytes;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            return std::hash<uint64_t>()(k.index) ^ (std::hash<uint64_t>()(((uint64_t)k.scale << 32) | (uint32_t)k.format) << 1);
+        }
+    };
+
+    void evict(std::vector<VideoFrame>& evicted) {
+        while (bytes_ > capacity_ && !lru_.empty()) {
+            auto& e = lru_.back();
+            bytes_ -= e.bytes;
+            evicted.push_back(std::move(e.frame));
+            map_.erase(e.key);
+            lru_.pop_back();
+        }
+    }
+
+    mutable std::mutex mtx_;
+    std::list<Entry> lru_; // front is the most recently used
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map_;
+    std::atomic<size_t> capacity_ = 0;
+    size_t bytes_ = 0;
+    std::atomic<uint64_t> hits_ = 0;
+    std::atomic<uint64_t> misses_ = 0;
+};
+
+MDK_NS_END
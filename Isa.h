@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <cstring>
+
+// simd instruction sets of the target and the running cpu, for kernels selected at runtime
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+# define ISA_X86 1
+# include <immintrin.h>
+# if defined(_MSC_VER) && !defined(__clang__)
+#  include <intrin.h>
+#  define ISA_TARGET(x)
+# else
+#  define ISA_TARGET(x) __attribute__((target(x)))
+# endif
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+# define ISA_NEON 1
+# include <arm_neon.h>
+#endif
+
+namespace isa {
+
+struct Cpu {
+    bool sse41 = false;
+    bool avx2 = false;
+    bool neon = false; // always available if built for arm with neon
+};
+
+// detected once
+inline const Cpu& cpu()
+{
+    static const Cpu c = []{
+        Cpu c;
+#if ISA_X86
+# if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        c.sse41 = info[2] & (1 << 19);
+        const bool osxsave = info[2] & (1 << 27);
+        __cpuidex(info, 7, 0);
+        c.avx2 = osxsave && (info[1] & (1 << 5)) && (_xgetbv(0) & 6) == 6;
+# else
+        c.sse41 = __builtin_cpu_supports("sse4.1");
+        c.avx2 = __builtin_cpu_supports("avx2");
+# endif
+#elif ISA_NEON
+        c.neon = true;
+#endif
+        return c;
+    }();
+    return c;
+}
+
+// kernels named name can be selected. force: a name to select in tests, nullptr for the best available
+inline bool allowed(const char* force, const char* name)
+{
+    return !force || strcmp(force, name) == 0;
+}
+
+} // namespace isa
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+// submitted jobs and their epoch, not owned. track() and untrack() are called for every job, including stale ones, and never take a lock
+template<typename Job, size_t N = 128>
+class JobTable
+{
+public:
+    // before the job is submitted. false if full, then the job can not be aborted by forEachStale()
+    bool track(Job* job, uint32_t epoch) {
+        for (auto& s : slots_) {
+            bool used = false;
+            if (s.used.load(std::memory_order_relaxed) || !s.used.compare_exchange_strong(used, true, std::memory_order_acquire))
+                continue;
+            s.epoch.store(epoch, std::memory_order_relaxed);
+            s.job.store(job, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // in the job callback, before the job is released
+    void untrack(Job* job) {
+        for (auto& s : slots_) {
+            auto j = job;
+            if (s.job.load(std::memory_order_relaxed) != job || !s.job.compare_exchange_strong(j, nullptr))
+                continue;
+            while (s.pins.load() > 0) // forEachStale() is referencing the job
+                std::this_thread::yield();
+            s.used.store(false, std::memory_order_release);
+            return;
+        }
+    }
+
+    // f(job) for jobs not in epoch. the job is alive in f, e.g. AddRef and Abort later
+    template<typename F>
+    void forEachStale(uint32_t epoch, F&& f) {
+        for (auto& s : slots_) {
+            s.pins.fetch_add(1);
+            if (const auto j = s.job.load(); j && s.epoch.load(std::memory_order_relaxed) != epoch)
+                f(j);
+            s.pins.fetch_sub(1, std::memory_order_release);
+        }
+    }
+private:
+    struct alignas(64) Slot {
+        std::atomic<Job*> job = nullptr;
+        std::atomic<uint32_t> epoch = 0;
+        std::atomic<int> pins = 0;
+        std::atomic<bool> used = false;
+    };
+    Slot slots_[N];
+};
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <atomic>
+
+// unbounded lock-free multiple producer single consumer queue. push() never waits or fails, a node is allocated for each value
+template<typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() : head_(new Node()), tail_(head_.load()) {}
+    ~MpscQueue() {
+        for (T v; pop(v);) {}
+        delete tail_;
+    }
+
+    // any thread
+    void push(T&& v) {
+        const auto n = new Node{std::move(v)};
+        head_.exchange(n, std::memory_order_acq_rel)->next.store(n, std::memory_order_release);
+    }
+
+    // consumer. false if empty, or the next value is being pushed, then the producer wakes the consumer again
+    bool pop(T& v) {
+        const auto next = tail_->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        v = std::move(next->value);
+        delete tail_;
+        tail_ = next; // the new stub
+        return true;
+    }
+private:
+    struct Node {
+        T value{};
+        std::atomic<Node*> next = nullptr;
+    };
+    alignas(64) std::atomic<Node*> head_; // the last pushed
+    alignas(64) Node* tail_; // stub, the first value is in its next
+};
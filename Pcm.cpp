@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#include "Pcm.h"
+#include "Isa.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace pcm {
+namespace {
+
+constexpr float kS16 = 1.0f / 32768.0f;
+constexpr float kS32 = 1.0f / 2147483648.0f;
+
+// n values from i
+using Row = void(*)(const uint8_t* src, float* dst, size_t n, size_t i);
+
+void u8_c(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    for (; i < n; ++i)
+        d[i] = float(int(s[i]) - 128) * (1.0f / 128.0f);
+}
+
+void s16_c(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    for (; i < n; ++i) {
+        int16_t v;
+        memcpy(&v, s + 2 * i, 2);
+        d[i] = float(v) * kS16;
+    }
+}
+
+void s24_c(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    for (; i < n; ++i) {
+        const auto p = s + 3 * i;
+        const int32_t v = int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24); // sign in msb
+        d[i] = float(v) * kS32;
+    }
+}
+
+void s32_c(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    for (; i < n; ++i) {
+        int32_t v;
+        memcpy(&v, s + 4 * i, 4);
+        d[i] = float(v) * kS32;
+    }
+}
+
+#if ISA_X86
+ISA_TARGET("sse4.1")
+void s16_sse41(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    const __m128 k = _mm_set1_ps(kS16);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(s + 2 * i));
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(v)), k));
+        _mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(v, 8))), k));
+    }
+    s16_c(s, d, n, i);
+}
+
+ISA_TARGET("sse4.1")
+void s32_sse41(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    const __m128 k = _mm_set1_ps(kS32);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(s + 4 * i))), k));
+    s32_c(s, d, n, i);
+}
+
+ISA_TARGET("avx2")
+void s16_avx2(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    const __m256 k = _mm256_set1_ps(kS16);
+    for (; i + 16 <= n; i += 16) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(s + 2 * i));
+        _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v))), k));
+        _mm256_storeu_ps(d + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1))), k));
+    }
+    s16_sse41(s, d, n, i);
+}
+
+ISA_TARGET("avx2")
+void s32_avx2(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    const __m256 k = _mm256_set1_ps(kS32);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(s + 4 * i))), k));
+    s32_c(s, d, n, i);
+}
+#endif // ISA_X86
+
+#if ISA_NEON
+void s16_neon(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t v = vld1q_s16((const int16_t*)(s + 2 * i));
+        vst1q_f32(d + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), kS16));
+        vst1q_f32(d + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), kS16));
+    }
+    s16_c(s, d, n, i);
+}
+
+void s32_neon(const uint8_t* s, float* d, size_t n, size_t i)
+{
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(d + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32((const int32_t*)(s + 4 * i))), kS32));
+    s32_c(s, d, n, i);
+}
+#endif // ISA_NEON
+
+struct Kernels {
+    const char* name;
+    Row s16;
+    Row s32;
+};
+
+Kernels select(const char* force)
+{
+    [[maybe_unused]] const auto& cpu = isa::cpu();
+#if ISA_X86
+    if (cpu.avx2 && isa::allowed(force, "avx2"))
+        return {"avx2", s16_avx2, s32_avx2};
+    if (cpu.sse41 && isa::allowed(force, "sse4.1"))
+        return {"sse4.1", s16_sse41, s32_sse41};
+#elif ISA_NEON
+    if (cpu.neon && isa::allowed(force, "neon"))
+        return {"neon", s16_neon, s32_neon};
+#endif
+    return {"c", s16_c, s32_c};
+}
+
+Kernels& kernels()
+{
+    static Kernels k = select(nullptr);
+    return k;
+}
+
+Row row(int bitDepth)
+{
+    switch (sampleBytes(bitDepth)) {
+    case 1: return u8_c;
+    case 2: return kernels().s16;
+    case 3: return s24_c;
+    case 4: return kernels().s32;
+    }
+    return nullptr;
+}
+} // namespace
+
+void toFloat(const uint8_t* src, int bitDepth, int channels, int samples, float* const* dst, bool planar)
+{
+    const auto f = row(bitDepth);
+    if (!f || channels <= 0 || samples <= 0)
+        return;
+    if (!planar || channels == 1) {
+        f(src, dst[0], size_t(samples) * channels, 0);
+        return;
+    }
+    constexpr int kBlock = 4096; // values converted on stack, then deinterleaved
+    float tmp[kBlock];
+    const int frames = std::max(kBlock / channels, 1);
+    const auto bytes = sampleBytes(bitDepth) * channels;
+    for (int s = 0; s < samples; s += frames) {
+        const int n = std::min(frames, samples - s);
+        if (n * channels > kBlock) { // too many channels for a block
+            for (int c = 0; c < channels; ++c) {
+                for (int i = 0; i < n; ++i)
+                    f(src + (size_t(s + i) * channels + c) * sampleBytes(bitDepth), dst[c] + s + i, 1, 0);
+            }
+            continue;
+        }
+        f(src + size_t(s) * bytes, tmp, size_t(n) * channels, 0);
+        for (int c = 0; c < channels; ++c) {
+            float* d = dst[c] + s;
+            for (int i = 0; i < n; ++i)
+                d[i] = tmp[i * channels + c];
+        }
+    }
+}
+
+const char* isa(const char* force)
+{
+    if (force)
+        kernels() = select(force);
+    return kernels().name;
+}
+
+} // namespace pcm
@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// pcm of IBlackmagicRawClipAudio::GetAudioSamples: interleaved little endian, 8-bit unsigned, 16/24/32-bit signed
+namespace pcm {
+
+// bytes of a sample of a channel
+inline int sampleBytes(int bitDepth) { return (bitDepth + 7) / 8; }
+
+// convert to float in [-1, 1). planar: dst[c] for each channel, otherwise interleaved dst[0]
+void toFloat(const uint8_t* src, int bitDepth, int channels, int samples, float* const* dst, bool planar);
+
+// simd set of the 16 and 32-bit converters in use, or "c". force: "c", "sse4.1", "avx2" or "neon" to compare them in tests/KernelTest.cpp
+const char* isa(const char* force = nullptr);
+
+} // namespace pcm
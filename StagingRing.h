@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include "BlackmagicRawAPI.h"
+#include "ComPtr.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+
+// cpu readable copies of gpu processed images. a slot is reused after all frames referencing it are destroyed,
+// and resources are released when the ring and all frames are destroyed
+class StagingRing : public std::enable_shared_from_this<StagingRing>
+{
+public:
+    StagingRing(IBlackmagicRawResourceManager* mgr, IBlackmagicRawPipelineDevice* dev, void* context, void* cmdQueue, size_t maxSlots)
+        : mgr_(mgr), dev_(dev), context_(context), cmdQueue_(cmdQueue), maxSlots_(maxSlots)
+    {}
+
+    ~StagingRing() {
+        for (auto& s : slots_)
+            destroy(s);
+    }
+
+    // slots are not destroyed if less than current slots
+    void setCapacity(size_t maxSlots) {
+        const std::scoped_lock lock(mtx_);
+        maxSlots_ = maxSlots;
+    }
+
+    // copy gpu resource to a free slot, returns immediately for opencl. res must be alive until take(). -1 if all slots are in use or failed
+    // cuda and metal block here: the resource manager has no fence for them, but opencl can wait in the in order queue
+    int enqueue(void* res, BlackmagicRawResourceType type, uint32_t size) {
+        const auto i = acquire(size, type);
+        if (i < 0)
+            return -1;
+        auto& s = slots_[i]; // used by this thread only
+        const bool async = type == blackmagicRawResourceTypeBufferOpenCL; // gpu => cpu readable gpu, then => cpu in take()
+        if (FAILED(mgr_->CopyResource(context_, cmdQueue_, res, type, s.res, type, size, async))) {
+            release(i);
+            return -1;
+        }
+        return i;
+    }
+
+    // wait for the copy to slot. the returned host data releases the slot. null if slot < 0 or failed
+    std::shared_ptr<uint8_t> take(int slot) {
+        if (slot < 0)
+            return {};
+        auto& s = slots_[slot];
+        if (s.type == blackmagicRawResourceTypeBufferOpenCL // blocking read after the queued copy
+            && FAILED(mgr_->CopyResource(context_, cmdQueue_, s.res, s.type, s.host, blackmagicRawResourceTypeBufferCPU, s.size, false))) {
+            release(slot);
+            return {};
+        }
+        return {s.host, [self = shared_from_this(), slot](uint8_t*) { self->release(slot); }};
+    }
+
+    // a slot not taken
+    void release(int i) {
+        const std::scoped_lock lock(mtx_);
+        slots_[i].used = false;
+    }
+
+    std::shared_ptr<uint8_t> copy(void* res, BlackmagicRawResourceType type, uint32_t size) {
+        return take(enqueue(res, type, size));
+    }
+private:
+    struct Slot {
+        void* res = nullptr;
+        BlackmagicRawResourceType type = 0;
+        uint8_t* host = nullptr;
+        bool ownHost = false; // host is not mapped from res
+        uint32_t size = 0;
+        bool used = false;
+    };
+
+    int acquire(uint32_t size, BlackmagicRawResourceType type) {
+        const std::scoped_lock lock(mtx_);
+        int i = -1;
+        for (int j = 0; j < (int)slots_.size(); ++j) {
+            if (slots_[j].used)
+                continue;
+            i = j;
+            if (slots_[j].size == size && slots_[j].type == type)
+                break;
+        }
+        if (i < 0 || slots_[i].size != size || slots_[i].type != type) {
+            if (slots_.size() < maxSlots_) { // prefer a new slot than reallocating a free one
+                i = (int)slots_.size();
+                slots_.emplace_back();
+            }
+            if (i < 0)
+                return -1;
+            auto& s = slots_[i];
+            destroy(s);
+            if (!alloc(s, size, type)) {
+                destroy(s);
+                return -1;
+            }
+        }
+        slots_[i].used = true;
+        return i;
+    }
+
+    bool alloc(Slot& s, uint32_t size, BlackmagicRawResourceType type) {
+        s.size = size;
+        s.type = type;
+        if (type == blackmagicRawResourceTypeBufferOpenCL) {
+            if (FAILED(mgr_->CreateResource(context_, cmdQueue_, size, type, blackmagicRawResourceUsageReadCPUWriteGPU, &s.res)))
+                return false;
+            s.host = new uint8_t[size];
+            s.ownHost = true;
+            return true;
+        }
+        for (auto usage : {blackmagicRawResourceUsageReadCPUWriteGPU, blackmagicRawResourceUsageReadCPUWriteCPU}) {
+            if (FAILED(mgr_->CreateResource(context_, cmdQueue_, size, type, usage, &s.res)))
+                continue;
+            if (SUCCEEDED(mgr_->GetResourceHostPointer(context_, cmdQueue_, s.res, type, (void**)&s.host)) && s.host)
+                return true;
+            mgr_->ReleaseResource(context_, cmdQueue_, s.res, type);
+            s.res = nullptr;
+        }
+        return false;
+    }
+
+    void destroy(Slot& s) {
+        if (s.res)
+            mgr_->ReleaseResource(context_, cmdQueue_, s.res, s.type);
+        if (s.ownHost)
+            delete[] s.host;
+        s = {};
+    }
+
+    Microsoft::WRL::ComPtr<IBlackmagicRawResourceManager> mgr_;
+    Microsoft::WRL::ComPtr<IBlackmagicRawPipelineDevice> dev_; // keep context and queue alive
+    void* context_;
+    void* cmdQueue_;
+    size_t maxSlots_;
+    std::mutex mtx_;
+    std::deque<Slot> slots_; // references are stable when growing
+};
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#include "Waveform.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+
+using namespace std;
+
+namespace waveform {
+namespace {
+
+constexpr char kMagic[4] = {'B', 'R', 'W', 'F'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kZoom = 4; // samples per peak of the next level
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t channels;
+    uint32_t sampleRate;
+    uint64_t samples;
+    uint32_t levels;
+    uint32_t reserved;
+};
+
+int16_t to16(float v)
+{
+    return (int16_t)lrintf(clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+Level reduce(const Level& fine, uint32_t channels)
+{ // rms of 4 peaks of the same size is sqrt(mean(rms^2)), the last peak may be smaller but it's an overview
+    Level l{fine.samplesPerPeak * kZoom, {}};
+    const size_t n = fine.peaks.size() / channels;
+    l.peaks.reserve((n + kZoom - 1) / kZoom * channels);
+    for (size_t i = 0; i < n; i += kZoom) {
+        const auto e = min<size_t>(i + kZoom, n);
+        for (uint32_t c = 0; c < channels; ++c) {
+            Peak p{numeric_limits<int16_t>::max(), numeric_limits<int16_t>::min(), 0};
+            double sq = 0;
+            for (auto j = i; j < e; ++j) {
+                const auto& f = fine.peaks[j * channels + c];
+                p.min = min(p.min, f.min);
+                p.max = max(p.max, f.max);
+                sq += double(f.rms) * f.rms;
+            }
+            p.rms = (int16_t)lrint(sqrt(sq / double(e - i)));
+            l.peaks.push_back(p);
+        }
+    }
+    return l;
+}
+} // namespace
+
+Builder::Builder(uint32_t channels, uint32_t sampleRate, uint32_t samplesPerPeak, int levels)
+    : min_(channels), max_(channels), sq_(channels), levels_(max(levels, 1))
+{
+    o_.channels = channels;
+    o_.sampleRate = sampleRate;
+    o_.levels.push_back({max(samplesPerPeak, 1u), {}});
+    flush();
+}
+
+void Builder::add(const float* samples, uint32_t count)
+{
+    const auto channels = o_.channels;
+    const auto spp = o_.levels[0].samplesPerPeak;
+    while (count > 0) {
+        const auto n = min(count, spp - n_);
+        for (uint32_t c = 0; c < channels; ++c) {
+            float lo = min_[c], hi = max_[c];
+            double sq = 0;
+            for (uint32_t i = 0; i < n; ++i) {
+                const float v = samples[i * channels + c];
+                lo = min(lo, v);
+                hi = max(hi, v);
+                sq += double(v) * v;
+            }
+            min_[c] = lo;
+            max_[c] = hi;
+            sq_[c] += sq;
+        }
+        samples += size_t(n) * channels;
+        count -= n;
+        n_ += n;
+        o_.samples += n;
+        if (n_ == spp)
+            flush();
+    }
+}
+
+void Builder::flush()
+{
+    if (n_ > 0) {
+        for (uint32_t c = 0; c < o_.channels; ++c)
+            o_.levels[0].peaks.push_back({to16(min_[c]), to16(max_[c]), to16((float)sqrt(sq_[c] / n_))});
+    }
+    n_ = 0;
+    fill(min_.begin(), min_.end(), numeric_limits<float>::max());
+    fill(max_.begin(), max_.end(), numeric_limits<float>::lowest());
+    fill(sq_.begin(), sq_.end(), 0.0);
+}
+
+Overview Builder::finish()
+{
+    flush();
+    while ((int)o_.levels.size() < levels_ && o_.levels.back().peaks.size() > o_.channels)
+        o_.levels.push_back(reduce(o_.levels.back(), o_.channels));
+    return std::move(o_);
+}
+
+bool save(const Overview& o, uint64_t key, const string& path)
+{
+    error_code ec;
+    filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+    const auto tmp = path + ".tmp";
+    auto f = fopen(tmp.data(), "wb");
+    if (!f)
+        return false;
+    Header h{};
+    memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.key = key;
+    h.channels = o.channels;
+    h.sampleRate = o.sampleRate;
+    h.samples = o.samples;
+    h.levels = (uint32_t)o.levels.size();
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (const auto& l : o.levels) {
+        const uint32_t v[2] = {l.samplesPerPeak, (uint32_t)l.peaks.size()};
+        ok = ok && fwrite(v, sizeof(v), 1, f) == 1;
+        ok = ok && (l.peaks.empty() || fwrite(l.peaks.data(), sizeof(Peak), l.peaks.size(), f) == l.peaks.size());
+    }
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+        filesystem::rename(tmp, path, ec); // readers never see a partial file
+    if (!ok || ec)
+        filesystem::remove(tmp, ec);
+    return ok && !ec;
+}
+
+bool load(const string& path, uint64_t key, Overview& o)
+{
+    error_code ec;
+    auto left = filesystem::file_size(path, ec); // bytes not read
+    if (ec)
+        return false;
+    auto f = fopen(path.data(), "rb");
+    if (!f)
+        return false;
+    Header h{};
+    bool ok = left >= sizeof(h) && fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, kMagic, sizeof(kMagic)) == 0 && h.version == kVersion && h.key == key
+        && h.channels > 0 && h.levels <= 32;
+    left -= ok ? sizeof(h) : 0;
+    Overview r;
+    r.channels = h.channels;
+    r.sampleRate = h.sampleRate;
+    r.samples = h.samples;
+    uint64_t spp = 0; // samples per peak of the previous level
+    for (uint32_t i = 0; ok && i < h.levels; ++i) {
+        uint32_t v[2] = {};
+        ok = left >= sizeof(v) && fread(v, sizeof(v), 1, f) == 1;
+        left -= ok ? sizeof(v) : 0;
+        // a level has exactly ceil(samples / samplesPerPeak) peaks of each channel, and is kZoom times coarser than the previous one
+        ok = ok && v[0] > 0 && (i == 0 || v[0] == spp * kZoom) && v[1] == (h.samples + v[0] - 1) / v[0] * h.channels
+            && uint64_t(v[1]) * sizeof(Peak) <= left;
+        if (!ok)
+            break;
+        spp = v[0];
+        left -= uint64_t(v[1]) * sizeof(Peak);
+        Level l{v[0], vector<Peak>(v[1])};
+        ok = l.peaks.empty() || fread(l.peaks.data(), sizeof(Peak), l.peaks.size(), f) == l.peaks.size();
+        r.levels.push_back(std::move(l));
+    }
+    fclose(f);
+    if (ok)
+        o = std::move(r);
+    return ok;
+}
+
+} // namespace waveform
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// audio waveform overview: min, max and rms of every channel at several zoom levels
+namespace waveform {
+
+struct Peak {
+    int16_t min; // sample * 32767
+    int16_t max;
+    int16_t rms;
+};
+
+struct Level {
+    uint32_t samplesPerPeak;
+    std::vector<Peak> peaks; // peak i of channel c: peaks[i * channels + c]
+};
+
+struct Overview {
+    uint32_t channels = 0;
+    uint32_t sampleRate = 0;
+    uint64_t samples = 0; // per channel
+    std::vector<Level> levels; // finest first, each level is 4x coarser
+};
+
+// accumulates interleaved float samples in order
+class Builder
+{
+public:
+    Builder(uint32_t channels, uint32_t sampleRate, uint32_t samplesPerPeak = 256, int levels = 4);
+    void add(const float* samples, uint32_t count); // count: samples per channel
+    Overview finish();
+private:
+    void flush();
+
+    Overview o_;
+    uint32_t n_ = 0; // samples in the current peak
+    std::vector<float> min_;
+    std::vector<float> max_;
+    std::vector<double> sq_;
+    int levels_;
+};
+
+// compact binary file: header(magic "BRWF", version, key, channels, sample rate, samples, levels), then samplesPerPeak, peak count and peaks of each level
+// key: clip identity, a file of another key is rejected
+bool save(const Overview& o, uint64_t key, const std::string& path);
+bool load(const std::string& path, uint64_t key, Overview& o);
+
+} // namespace waveform
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+// simd kernels of convert and pcm must be bit exact with the c kernels. build with -DBRAW_TESTS=ON, run by ctest
+#include "Convert.h"
+#include "Pcm.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const char* const kIsas[] = {"sse4.1", "avx2", "neon"};
+mt19937 rng(1);
+int fails = 0;
+
+vector<uint8_t> noise(size_t bytes)
+{
+    vector<uint8_t> v(bytes);
+    for (auto& b : v)
+        b = (uint8_t)rng();
+    return v;
+}
+
+void expect(bool ok, const string& what)
+{
+    if (ok)
+        return;
+    printf("mismatch: %s\n", what.data());
+    fails++;
+}
+
+using Planes = vector<vector<uint8_t>>;
+
+Planes convertWith(const char* isa, const vector<uint8_t>& src, size_t stride, int sw, int sh, int w, int h, convert::Filter filter, convert::Target target, convert::Matrix matrix, bool fullRange)
+{
+    convert::isa(isa);
+    const auto l = convert::layout(target, w, h);
+    Planes out(l.planes);
+    uint8_t* dst[3]{};
+    for (int p = 0; p < l.planes; ++p) {
+        out[p].assign(l.size[p], 0);
+        dst[p] = out[p].data();
+    }
+    if (sw == w && sh == h)
+        convert::rgba64(src.data(), stride, w, h, target, matrix, fullRange, dst, l.stride);
+    else
+        convert::rgba64(src.data(), stride, sw, sh, w, h, filter, target, matrix, fullRange, dst, l.stride);
+    return out;
+}
+
+vector<uint8_t> resizeWith(const char* isa, const vector<uint8_t>& src, size_t stride, int sw, int sh, int bpc, int w, int h, convert::Filter filter)
+{
+    convert::isa(isa);
+    const size_t dstStride = 4 * (size_t)bpc * w;
+    vector<uint8_t> out(dstStride * h);
+    convert::resize(src.data(), stride, sw, sh, bpc, out.data(), dstStride, w, h, filter);
+    return out;
+}
+
+void testConvert(const char* isa)
+{
+    for (int sw : {1, 7, 33, 130}) for (int sh : {1, 2, 65}) for (int w : {1, 16, 67}) for (int h : {2, 33}) for (int f = 0; f < 2; ++f) {
+        const size_t stride = 8 * (size_t)sw + 16;
+        const auto src = noise(stride * sh);
+        const auto filter = (convert::Filter)f;
+        for (int bpc : {1, 2}) {
+            const auto name = string(isa) + " resize " + to_string(sw) + "x" + to_string(sh) + "->" + to_string(w) + "x" + to_string(h) + " bpc" + to_string(bpc) + " filter" + to_string(f);
+            expect(resizeWith(isa, src, stride, sw, sh, bpc, w, h, filter) == resizeWith("c", src, stride, sw, sh, bpc, w, h, filter), name);
+        }
+        for (int t = 0; t < 4; ++t) for (int m = 0; m < 3; ++m) for (bool full : {false, true}) {
+            const auto target = (convert::Target)t;
+            const auto matrix = (convert::Matrix)m;
+            const auto name = string(isa) + " convert " + to_string(sw) + "x" + to_string(sh) + "->" + to_string(w) + "x" + to_string(h) + " target" + to_string(t) + " matrix" + to_string(m) + " full" + to_string(full);
+            expect(convertWith(isa, src, stride, sw, sh, w, h, filter, target, matrix, full) == convertWith("c", src, stride, sw, sh, w, h, filter, target, matrix, full), name);
+            if (f == 0) // same size
+                expect(convertWith(isa, src, stride, sw, sh, sw, sh, filter, target, matrix, full) == convertWith("c", src, stride, sw, sh, sw, sh, filter, target, matrix, full), name + " no resize");
+        }
+    }
+}
+
+vector<vector<float>> pcmWith(const char* isa, const vector<uint8_t>& src, int bits, int channels, int samples, bool planar)
+{
+    pcm::isa(isa);
+    vector<vector<float>> out(planar ? channels : 1, vector<float>(planar ? samples : (size_t)samples * channels));
+    vector<float*> dst;
+    for (auto& o : out)
+        dst.push_back(o.data());
+    pcm::toFloat(src.data(), bits, channels, samples, dst.data(), planar);
+    return out;
+}
+
+void testPcm(const char* isa)
+{
+    for (int bits : {16, 32}) for (int channels : {1, 2, 6, 5000}) for (int samples : {1, 15, 1027}) for (bool planar : {false, true}) {
+        const auto src = noise((size_t)pcm::sampleBytes(bits) * channels * samples);
+        const auto name = string(isa) + " pcm s" + to_string(bits) + " " + to_string(channels) + "ch " + to_string(samples) + " samples" + (planar ? " planar" : "");
+        expect(pcmWith(isa, src, bits, channels, samples, planar) == pcmWith("c", src, bits, channels, samples, planar), name);
+    }
+}
+} // namespace
+
+int main()
+{
+    const auto best = string(convert::isa());
+    int tested = 0;
+    for (auto isa : kIsas) {
+        if (strcmp(convert::isa(isa), isa) != 0 || strcmp(pcm::isa(isa), isa) != 0) // not supported by the cpu or the build
+            continue;
+        testConvert(isa);
+        testPcm(isa);
+        tested++;
+    }
+    printf("best: %s, simd sets tested: %d, mismatches: %d\n", best.data(), tested, fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2025 WangBin <wbsecg1 at gmail.com>
+ * braw plugin for libmdk
+ */
+// stress JobTable with fake jobs and a model of the epoch logic of the reader: submitters, sdk worker callbacks, seek and unload threads run at the same time.
+// BRawReader itself is not tested. the Seeking state of the reader is modeled as running with a seek in flight, i.e. an epoch change.
+// build with -DBRAW_STRESS=ON, better with -fsanitize=thread or address. run by ctest, or braw-stress [seconds]. exit code 1 if a job leaks or is still tracked
+#include "BlackmagicRawAPI.h"
+#include "ComPtr.h"
+#include "JobTable.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Microsoft::WRL; //ComPtr
+
+namespace {
+
+atomic<int> liveJobs = 0;
+
+class FakeJob final : public IBlackmagicRawJob
+{
+public:
+    FakeJob(uint32_t epoch, class Driver* d) : epoch_(epoch), driver_(d) { liveJobs++; }
+    ~FakeJob() { canary_ = 0; liveJobs--; }
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, LPVOID*) override { return E_NOTIMPL; }
+    ULONG STDMETHODCALLTYPE AddRef() override { check(); return ++ref_; }
+    ULONG STDMETHODCALLTYPE Release() override {
+        check();
+        const auto r = --ref_;
+        if (r == 0)
+            delete this;
+        return r;
+    }
+    HRESULT Submit() override;
+    HRESULT Abort() override { check(); aborted_ = true; return S_OK; }
+    HRESULT SetUserData(void* data) override { data_ = data; return S_OK; }
+    HRESULT GetUserData(void** data) override { *data = data_; return S_OK; }
+
+    uint32_t epoch() const { return epoch_; }
+    bool aborted() const { return aborted_; }
+private:
+    void check() const {
+        if (canary_ != kCanary) {
+            fprintf(stderr, "job used after destroyed\n");
+            abort();
+        }
+    }
+    static constexpr uint32_t kCanary = 0xb4a3f00d;
+    uint32_t canary_ = kCanary;
+    atomic<ULONG> ref_ = 1;
+    atomic<bool> aborted_ = false;
+    void* data_ = nullptr;
+    uint32_t epoch_;
+    Driver* driver_;
+};
+
+// sdk job queue and callbacks, reader side scheduling
+class Driver
+{
+public:
+    explicit Driver(int workers) {
+        for (int i = 0; i < workers; ++i)
+            workers_.emplace_back([this]{ work(); });
+    }
+    ~Driver() {
+        {
+            const scoped_lock lock(queue_mtx_);
+            stop_ = true;
+        }
+        queued_.notify_all();
+        for (auto& t : workers_)
+            t.join();
+    }
+
+    void queue(FakeJob* job) {
+        {
+            const scoped_lock lock(queue_mtx_);
+            queue_.push_back(job);
+        }
+        queued_.notify_one();
+    }
+
+    // models BRawReader::schedule() and readAt()
+    void submit() {
+        uint32_t epoch = 0;
+        {
+            const scoped_lock lock(sched_mtx_);
+            if (inflight_ >= 8)
+                return;
+            inflight_++;
+            epoch = epoch_;
+        }
+        auto job = new FakeJob(epoch, this);
+        jobs_.track(job, epoch);
+        job->Submit();
+    }
+
+    // models BRawReader::seekTo() and unload()
+    void seek(bool unload) {
+        {
+            const scoped_lock lock(sched_mtx_);
+            ++epoch_;
+            inflight_ = 0;
+        }
+        abortStale();
+        if (unload)
+            flush();
+    }
+
+    // FlushJobs()
+    void flush() {
+        unique_lock lock(queue_mtx_);
+        idle_.wait(lock, [this]{ return queue_.empty() && running_ == 0; });
+    }
+
+    void report() const {
+        printf("completed %llu, stale %llu (aborted %llu), locked stale %llu, live jobs %d\n"
+            , (unsigned long long)completed_, (unsigned long long)stale_, (unsigned long long)aborted_, (unsigned long long)lockedStale_, liveJobs.load());
+    }
+
+    bool ok() const {
+        int tracked = 0;
+        const_cast<JobTable<IBlackmagicRawJob>&>(jobs_).forEachStale(~epoch_.load(), [&](IBlackmagicRawJob*) { tracked++; });
+        return liveJobs == 0 && tracked == 0;
+    }
+private:
+    void abortStale() {
+        vector<ComPtr<IBlackmagicRawJob>> jobs;
+        jobs_.forEachStale(epoch_, [&](IBlackmagicRawJob* job) { jobs.emplace_back(job); });
+        for (const auto& job : jobs)
+            job->Abort();
+    }
+
+    // ReadComplete()/ProcessComplete() and complete()
+    void callback(FakeJob* job) {
+        ComPtr<IBlackmagicRawJob> j;
+        j.Attach(job);
+        jobs_.untrack(job);
+        if (job->epoch() != epoch_.load(memory_order_acquire)) {
+            stale_++;
+            if (job->aborted())
+                aborted_++;
+            return;
+        }
+        const scoped_lock lock(sched_mtx_);
+        if (job->epoch() != epoch_) {
+            lockedStale_++;
+            return;
+        }
+        inflight_--;
+        completed_++;
+    }
+
+    void work() {
+        mt19937 rng(random_device{}());
+        unique_lock lock(queue_mtx_);
+        while (true) {
+            queued_.wait(lock, [this]{ return stop_ || !queue_.empty(); });
+            if (stop_ && queue_.empty())
+                return;
+            auto job = queue_.front();
+            queue_.pop_front();
+            running_++;
+            lock.unlock();
+            if (!job->aborted())
+                this_thread::sleep_for(chrono::microseconds(rng() % 200)); // decoding
+            callback(job);
+            lock.lock();
+            if (--running_ == 0 && queue_.empty())
+                idle_.notify_all();
+        }
+    }
+
+    mutex queue_mtx_;
+    condition_variable queued_;
+    condition_variable idle_;
+    deque<FakeJob*> queue_;
+    int running_ = 0;
+    bool stop_ = false;
+    vector<thread> workers_;
+
+    mutex sched_mtx_;
+    atomic<uint32_t> epoch_ = 0;
+    uint32_t inflight_ = 0;
+    JobTable<IBlackmagicRawJob> jobs_;
+    atomic<uint64_t> completed_ = 0;
+    atomic<uint64_t> stale_ = 0;
+    atomic<uint64_t> aborted_ = 0;
+    atomic<uint64_t> lockedStale_ = 0; // a stale result seen only after the lock: epoch_ changed between the 2 checks
+};
+
+HRESULT FakeJob::Submit()
+{
+    driver_->queue(this);
+    return S_OK;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const auto seconds = argc > 1 ? atoi(argv[1]) : 5;
+    bool ok = true;
+    {
+        Driver d(thread::hardware_concurrency());
+        atomic<bool> stop = false;
+        vector<thread> threads;
+        for (int i = 0; i < 2; ++i) { // delivery thread and refine thread
+            threads.emplace_back([&]{
+                while (!stop)
+                    d.submit();
+            });
+        }
+        for (int i = 0; i < 3; ++i) { // seekTo() from the ui, step and scrub
+            threads.emplace_back([&]{
+                mt19937 rng(random_device{}());
+                while (!stop) {
+                    d.seek(false);
+                    this_thread::sleep_for(chrono::microseconds(rng() % 500));
+                }
+            });
+        }
+        threads.emplace_back([&]{ // unload() and load()
+            while (!stop) {
+                d.seek(true);
+                this_thread::sleep_for(chrono::milliseconds(5));
+            }
+        });
+        this_thread::sleep_for(chrono::seconds(seconds));
+        stop = true;
+        for (auto& t : threads)
+            t.join();
+        d.seek(true);
+        d.report();
+        ok = d.ok();
+    }
+    printf("%s\n", ok && liveJobs == 0 ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}